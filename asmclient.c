@@ -0,0 +1,153 @@
+/*
+
+Client of asmserver: assembles or disassembles one file with the server, so the instruction set is not loaded again.
+
+	/// USAGE ///
+	asmclient [-s socket] [-r bytes] [-x] asm|dis input output
+	 asm			input is assembly source, output is written in Intel hex format (as the assembler does).
+	 dis			input is an Intel hex file, output is the disassembled text (as the disassembler does).
+	 -s socket		Unix socket of the server (default /tmp/asmserver.sock).
+	 -r bytes		number of data bytes of each hex record, from 1 to 255 (default 16).
+	 -x				dis writes operands in hex (0x..) instead of decimal (.12).
+	'-' stands for standard input or output. Warnings and errors are printed on standard error, and the program
+	returns the status of the server (0 ok, 17 no memory, 19 errors in source, 20 corrupted records, 21 invalid
+	request), 16 if input can't be read or 18 if the server can't be reached or output can't be written.
+	As with the assembler, if the source has errors no output file is created.
+	Build with: gcc -O2 asmclient.c protocol.c -o asmclient (or make)
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "protocol.h"
+
+#define HELP "Usage: asmclient [-s socket] [-r bytes] [-x] asm|dis input output\n"
+#define READCHUNK 65536		// bytes read at a time from input
+
+int readInput(const char*, char**, size_t*);
+int writeOutput(const char*, const char*, size_t);
+
+
+int main (int argc, char* argv[]) {
+	const char *socketName = DEFAULTSOCKET;
+	int recordSize = 0;					// 0: default of the server
+	int hexOperands = 0;
+	int command, fd, status;
+	char *data;
+	size_t size;
+	struct response response;
+
+	/***********		Read options		************/
+	while (argc > 2 && argv[1][0] == '-' && argv[1][1] != '\0') {
+		if (strcmp(argv[1], "-x") == 0) {
+			hexOperands = 1;
+			argc--;
+			argv++;
+			continue;
+		}
+		if (strcmp(argv[1], "-s") == 0)
+			socketName = argv[2];
+		else if (strcmp(argv[1], "-r") == 0) {
+			recordSize = atoi(argv[2]);
+			if (recordSize < 1 || recordSize > 255) {
+				printf("Record size must be from 1 to 255 bytes.\n");
+				return 0;
+			}
+		}
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc != 4 || (strcmp(argv[1], "asm") != 0 && strcmp(argv[1], "dis") != 0)) {
+		printf(HELP);
+		return 0;
+	}
+	command = (strcmp(argv[1], "asm") == 0) ? REQASSEMBLE : REQDISASSEMBLE;
+
+	/***********		Send request, read response		************/
+	if (readInput(argv[2], &data, &size) != 0) {
+		printf("Can't read %s.\n", argv[2]);
+		return 16;
+	}
+	if ((fd = connectServer(socketName)) < 0) {
+		printf("Can't connect to the server on %s.\n", socketName);
+		free(data);
+		return 18;
+	}
+	// byte 1 of the request is the record size for asm, the style of operands for dis
+	status = sendRequest(fd, command, (command == REQASSEMBLE) ? recordSize : hexOperands, argv[2], data, size) != 0
+			|| readResponse(fd, &response) != 0;
+	close(fd);
+	free(data);
+	if (status != 0) {
+		printf("The server closed the connection.\n");
+		return 18;
+	}
+
+	/***********		Messages and output		************/
+	fwrite(response.messages, 1, response.messagesLength, stderr);
+	status = response.status;
+	if (status == 0 || status == 20) {		// corrupted records are skipped, the rest is written anyway
+		if (writeOutput(argv[3], response.output, response.outputLength) != 0) {
+			printf("Can't write %s.\n", argv[3]);
+			status = 18;
+		}
+		else if (strcmp(argv[3], "-") != 0)
+			printf("File %s created.\n", argv[3]);
+	}
+	freeResponse(&response);
+	return status;
+}
+
+
+// FUNCTIONS DEFINITION
+int readInput(const char *fileName, char **data, size_t *size) {	// reads the whole file in a malloc'ed buffer
+	char *bigger;
+	size_t capacity = 0;
+	ssize_t numRead;
+	int fd = 0;							// '-' stands for standard input
+
+	if (strcmp(fileName, "-") != 0 && (fd = open(fileName, O_RDONLY)) < 0)
+		return 1;
+	*data = NULL;
+	*size = 0;
+	do {
+		if (*size + READCHUNK > capacity) {
+			capacity = (capacity == 0) ? 4*READCHUNK : 2*capacity;
+			if ((bigger = (char *)realloc(*data, capacity)) == NULL) {
+				free(*data);
+				if (fd != 0)
+					close(fd);
+				return 1;
+			}
+			*data = bigger;
+		}
+		numRead = read(fd, *data + *size, READCHUNK);
+		if (numRead > 0)
+			*size += numRead;
+	} while (numRead > 0);
+	if (fd != 0)
+		close(fd);
+	if (numRead < 0)
+		free(*data);
+	return (numRead < 0) ? 1 : 0;
+}
+
+
+int writeOutput(const char *fileName, const char *text, size_t length) {	// returns 1 if the file can't be written
+	FILE *filePtr = (strcmp(fileName, "-") == 0) ? stdout : fopen(fileName, "w");
+	int status;
+
+	if (filePtr == NULL)
+		return 1;
+	status = fwrite(text, 1, length, filePtr) != length;
+	if (filePtr != stdout)
+		status |= fclose(filePtr) != 0;
+	else
+		status |= fflush(stdout) != 0;
+	return status;
+}
@@ -0,0 +1,975 @@
+/*
+
+Assembler library, see asmlib.h.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "asmlib.h"
+
+//#define DEBUG		// uncomment to debug
+#define FLUSHWORDS 4096		// words of code placed in sequence kept in the image before they are streamed to the hex file
+#define SYMBOLSLOTS 64		// initial slots of the label hash table, doubled when half full
+
+
+int assembleToWords(const struct instructionSet *set, const char *source, size_t size, const char *sourceName, FILE *messages,
+		struct wordBuffer *program, struct assembleResult *result) {
+	return assembleSource(set, source, size, sourceName ? sourceName : "<memory>", messages, NULL, program, NULL, result, 0);
+}
+
+
+int assembleToHex(const struct instructionSet *set, const char *source, size_t size, const char *sourceName, FILE *messages, int recordSize,
+		char **hex, size_t *hexLength, struct assembleResult *result) {
+	struct hexWriter *hexFile = (struct hexWriter *)malloc(sizeof(struct hexWriter));
+
+	*hex = NULL;
+	*hexLength = 0;
+	if (hexFile == NULL) {
+		memset(result, 0, sizeof(struct assembleResult));
+		result->status = 17;
+		return 17;
+	}
+	openHexWriter(hexFile, -1, recordSize);		// -1: text is collected in hexFile->memory
+	assembleSource(set, source, size, sourceName ? sourceName : "<memory>", messages, hexFile, NULL, NULL, result, 0);
+	if (closeHexWriter(hexFile) != 0 && result->status == 0)
+		result->status = 17;
+	result->numRecords = hexFile->numRecords;
+	if (result->status == 0) {
+		*hex = hexFile->memory;
+		*hexLength = hexFile->memoryLength;
+	}
+	else
+		free(hexFile->memory);
+	free(hexFile);
+	return result->status;
+}
+
+
+int assembleSource(const struct instructionSet *set, const char *source, size_t size, const char *sourceName, FILE *messages,
+		struct hexWriter *hexFile, struct wordBuffer *program, struct lineMap *lines, struct assembleResult *result, int timePhases) {
+	// assembles the size bytes of source; it uses no global data, so many sources can be assembled at the same time
+	// words are put in hexFile and appended to program (both optional); messages are printed as sourceName:line:column
+	// lines, if not NULL, receives words and labels of each line for the cache of incremental mode
+	// timePhases 1 fills result->phases (hexFile keeps adding to it until it is closed)
+	int i;
+	struct lexer lex;
+	struct token acquiredOp;			// instruction acquired from asm file
+	int index;							// variable in which index of current instruction from instructionSet will be stored
+	int directive;						// DIRNONE, or the directive the token is
+	unsigned short hexInstruction;
+	struct memoryImage image;			// words placed so far, see asmlib.h
+	unsigned long address = 0;			// address of the next word
+	unsigned long value, limit;
+	unsigned short *word;
+	int first, numPlaced;
+	struct symbolTable symbols = {0, NULL, NULL, 0, 0};
+	struct fixupList fixups = {NULL, 0, 0};
+	struct symbol *label;
+	const struct instruction *instructionSet = set->instr;
+	struct phaseTimer *phases = NULL;	// NULL: nothing is timed
+	unsigned long numTokens = 0;
+	unsigned long long tick = 0;
+	int timed = 0;						// 1 if the current token is one of the samples
+
+	memset(result, 0, sizeof(struct assembleResult));
+	memset(&image, 0, sizeof(image));
+	if (timePhases)
+		phases = &result->phases;
+	if (hexFile != NULL)
+		hexFile->phases = phases;
+	initLexer(&lex, source, size, sourceName, messages);
+
+
+	/************		read each token of file		***************/
+	for (;;) {
+		if (phases != NULL && (timed = ((numTokens++ & (SAMPLEEVERY-1)) == 0)))	// 1 token in SAMPLEEVERY is timed
+			tick = readTicks();
+		if (!nextToken(&lex, &acquiredOp))
+			break;
+		if (phases != NULL) {
+			phases->events[PHASETOKENIZE]++;
+			if (timed)
+				tick = lapPhase(phases, PHASETOKENIZE, tick);
+		}
+		if (acquiredOp.start[acquiredOp.length-1] == ':') {		// label definition, ex: loop:
+			i = defineLabel(&symbols, &lex, &acquiredOp, acquiredOp.length-1, address);
+			if (i == 0 && lines != NULL)
+				i = markLine(lines, acquiredOp.line, 0, LINELABEL);
+			if (i == 17) {
+				result->status = 17;
+				break;
+			}
+			result->numErrors += i;
+			continue;
+		}
+		index = findInstruction(&set->opTable, instructionSet, acquiredOp.start, acquiredOp.length, &result->stats);	// index = -1 stands for instruction not valid.
+		if (phases != NULL) {
+			phases->events[PHASELOOKUP]++;
+			if (timed)
+				tick = lapPhase(phases, PHASELOOKUP, tick);
+		}
+		directive = (index == -1) ? findDirective(&acquiredOp) : DIRNONE;
+		if (index == -1 && directive == DIRNONE && acquiredOp.column == 1 && identifierLength(acquiredOp.start, acquiredOp.start + acquiredOp.length) == acquiredOp.length) {
+			i = defineLabel(&symbols, &lex, &acquiredOp, acquiredOp.length, address);	// label in column 1, without ':'
+			if (i == 0 && lines != NULL)
+				i = markLine(lines, acquiredOp.line, 0, LINELABEL);
+			if (i == 17) {
+				result->status = 17;
+				break;
+			}
+			result->numErrors += i;
+			continue;
+		}
+		#ifdef DEBUG
+			if (index != -1)
+				printf("Acquired op is: %s\n", instructionSet[index].name);
+		#endif
+
+		if (directive != DIRNONE) {			// dw, de, org, __config: each operand is read and its word placed
+			numPlaced = 0;
+			for (first=1; (i = parseDirective(&lex, directive, first, &value)) == 0; first=0) {
+				if (directive == DIRORG) {
+					address = value;
+					continue;
+				}
+				limit = (directive == DIRCONFIG) ? CONFIGADDRESS : address++;
+				if ((i = placeWord(&image, limit, value)) == 1) {
+					report(&lex, acquiredOp.line, acquiredOp.column, "error: address 0x%lx is already used", limit);
+					while (lex.cur < lex.end && *lex.cur != '\n')	// skip the rest of the line
+						lex.cur++;
+				}
+				if (i != 0)
+					break;
+				numPlaced++;
+			}
+			if (i == 2)						// no more operands
+				i = 0;
+			if (i == 0 && lines != NULL)
+				i = markLine(lines, acquiredOp.line, (directive == DIRDW || directive == DIRDE) ? numPlaced : 0,
+						(directive == DIRDW || directive == DIRDE) ? 0 : LINEADDRESS);
+			if (i == 17) {
+				result->status = 17;
+				break;
+			}
+			result->numErrors += i;
+			continue;
+		}
+
+		if (index != -1) {		// if index is not -1, it means that i found a correct instruction
+			// encodeInstruction extracts all operands following the instruction and puts them in hexInstruction with opCode
+			i = encodeInstruction(&instructionSet[index], &lex, &symbols, &fixups, address, &hexInstruction);
+			if (phases != NULL) {
+				phases->events[PHASEENCODE]++;
+				if (timed)
+					lapPhase(phases, PHASEENCODE, tick);
+			}
+			if (i == 0 && lines != NULL)
+				i = markLine(lines, acquiredOp.line, 1, 0);
+			if (i == 17) {
+				result->status = 17;
+				break;
+			}
+			else if (i != 0) {
+				result->numErrors++;
+				continue;
+			}
+
+			#ifdef DEBUG
+				printf("INSTRUCTION IS: %04x\n\n", hexInstruction);
+			#endif
+
+			if ((i = placeWord(&image, address, hexInstruction)) != 0) {	// load new hexInstruction
+				if (i == 17) {
+					result->status = 17;
+					break;
+				}
+				report(&lex, acquiredOp.line, acquiredOp.column, "error: address 0x%lx is already used", address);
+				result->numErrors++;
+			}
+			address++;
+			if (image.sequence - image.emitted >= FLUSHWORDS + IMAGEPAGEWORDS) {
+				limit = image.sequence;				// full pages of code placed in sequence are streamed to hex file
+				if (fixups.count > 0 && fixups.fixup[0].address < limit)	// words from the first fixup on may still change
+					limit = fixups.fixup[0].address;
+				if (limit - image.emitted >= FLUSHWORDS) {
+					if (phases != NULL)
+						tick = readTicks();
+					i = emitImage(&image, limit, hexFile, program);
+					if (phases != NULL) {
+						phases->events[PHASEEMIT]++;
+						lapPhase(phases, PHASEEMIT, tick);
+					}
+					if (i != 0) {
+						result->status = 17;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	if (phases != NULL)
+		tick = readTicks();
+	for (i=0; i<fixups.count; i++) {		// backpatch uses of labels defined after them
+		label = &symbols.symbol[fixups.fixup[i].symbol];
+		if (label->line == 0) {
+			report(&lex, fixups.fixup[i].line, fixups.fixup[i].column, "error: label %.*s is not defined", label->length, label->name);
+			result->numErrors++;
+		}
+		else if ((word = findWord(&image, fixups.fixup[i].address)) != NULL)
+			*word |= (label->value & ((1<<fixups.fixup[i].bits)-1)) << fixups.fixup[i].shift;
+	}
+	if (phases != NULL) {
+		phases->events[PHASEFIXUPS]++;
+		tick = lapPhase(phases, PHASEFIXUPS, tick);
+	}
+	if (emitImage(&image, (unsigned long)-1, hexFile, program) != 0 && result->status == 0)	// emit words left in the image
+		result->status = 17;
+	if (phases != NULL) {
+		phases->events[PHASEEMIT]++;
+		lapPhase(phases, PHASEEMIT, tick);
+	}
+	result->numWords = image.numWords;
+	if (lines != NULL && saveSymbols(lines, &symbols) != 0 && result->status == 0)
+		result->status = 17;
+	if (lines != NULL) {					// the cache needs to know where the runs are in the hex file
+		lines->run = image.run;
+		lines->numRuns = image.numRuns;
+		image.run = NULL;
+	}
+	result->numLabels = symbols.numSymbols;
+	for (i=0; i<symbols.numSymbols; i++)
+		if (symbols.symbol[i].line == 0)
+			result->numLabels--;
+	result->numFixups = fixups.count;
+	freeSymbols(&symbols, &fixups);
+
+	if (result->numErrors > 0 && result->status == 0)
+		result->status = 19;
+	result->bufferCapacity = (size_t)image.maxPages*IMAGEPAGEWORDS;
+	result->numAllocations = image.numAllocations;
+	freeImage(&image);
+	return result->status;
+}
+
+
+void initLexer(struct lexer *lex, const char *source, size_t size, const char *fileName, FILE *messages) {
+	lex->cur = source;
+	lex->end = source + size;
+	lex->lineStart = source;
+	lex->line = 1;
+	lex->fileName = fileName;
+	lex->messages = messages;
+}
+
+
+int nextToken(struct lexer *lex, struct token *tok) {	// returns 0 at end of file
+	const char *p = lex->cur;
+
+	while (p < lex->end) {						// skip blanks, new lines and comments
+		if (*p == '\n') {
+			lex->line++;
+			lex->lineStart = ++p;
+		}
+		else if (*p == ' ' || *p == '\t' || *p == '\r')
+			p++;
+		else if (*p == ';') {
+			while (p < lex->end && *p != '\n')
+				p++;
+		}
+		else
+			break;
+	}
+	if (p >= lex->end) {
+		lex->cur = p;
+		return 0;
+	}
+
+	tok->start = p;
+	tok->line = lex->line;
+	tok->column = p - lex->lineStart + 1;
+	while (p < lex->end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != ';')
+		p++;
+	tok->length = p - tok->start;
+	lex->cur = p;
+	return 1;
+}
+
+
+int encodeInstruction(const struct instruction *instr, struct lexer *lex, struct symbolTable *symbols, struct fixupList *fixups,
+		unsigned long address, unsigned short *word) {	// returns as parseOperands
+	int operands[2] = {0,0};				// vector containing operands values obtained from asm file
+	int j, status;
+
+	// parseOperands extracts all operands following the instruction and puts them into array operands[]
+	if ((status = parseOperands(lex, instr, operands, symbols, fixups, address)) != 0)
+		return status;
+	*word = ( instr->opCode << instr->shiftOpCode );	// puts opCode in word
+	for(j=0; j<instr->numOperands; j++) {				// puts operands in word
+		*word += ( operands[j] << instr->shiftOperand[j] );
+	}
+	return 0;
+}
+
+
+int findDirective(const struct token *tok) {	// DIRDW, DIRDE, DIRORG or DIRCONFIG if tok is one of them (any case), else DIRNONE
+	static const char *name[] = {"", "dw", "de", "org", "__config"};
+	int i, j;
+	char c;
+
+	for (i=DIRDW; i<=DIRCONFIG; i++) {
+		for (j=0; j<tok->length && name[i][j] != '\0'; j++) {
+			c = tok->start[j];
+			if (c >= 'A' && c <= 'Z')
+				c += 'a' - 'A';
+			if (c != name[i][j])
+				break;
+		}
+		if (j == tok->length && name[i][j] == '\0')
+			return i;
+	}
+	return DIRNONE;
+}
+
+
+int parseDirective(struct lexer *lex, int directive, int first, unsigned long *value) {
+	// reads the next operand of directive (after ',' if it is not the first one); returns 0, 1 if it is not valid
+	// (reported, rest of the line skipped) or 2 if there are no more operands (only de has more than one)
+	static const char *name[] = {"", "dw", "de", "org", "__config"};
+	static const unsigned long maximum[] = {0, 0xffff, 0xff, MAXNUMBER, 0x3fff};
+	unsigned long number;
+	int column;
+
+	while (lex->cur < lex->end && (*lex->cur == ' ' || *lex->cur == '\t'))
+		lex->cur++;
+	if (!first) {
+		if (directive != DIRDE || lex->cur >= lex->end || *lex->cur != ',')
+			return 2;
+		lex->cur++;
+		while (lex->cur < lex->end && (*lex->cur == ' ' || *lex->cur == '\t'))
+			lex->cur++;
+	}
+	column = lex->cur - lex->lineStart + 1;
+	if (parseNumber(lex, &number) != 0 || number > maximum[directive]) {
+		report(lex, lex->line, column, "error: invalid operand of %s (expected .decimal or 0xhex up to 0x%lx)", name[directive], maximum[directive]);
+		while (lex->cur < lex->end && *lex->cur != '\n')	// skip the rest of the line
+			lex->cur++;
+		return 1;
+	}
+	*value = number;
+	return 0;
+}
+
+
+int parseOperands(struct lexer *lex, const struct instruction *instr, int *operands, struct symbolTable *symbols,
+		struct fixupList *fixups, unsigned long address) {
+	// returns 0 if operands are valid, 1 if one is not, 17 if there is no memory. address is the address of the instruction
+	unsigned long number;
+	int j, length, index, column;
+
+	for (j=0; j<instr->numOperands; j++) {		// operands are on the same line of instruction, separated by ','
+		while (lex->cur < lex->end && (*lex->cur == ' ' || *lex->cur == '\t'))
+			lex->cur++;
+		if (j > 0) {
+			if (lex->cur >= lex->end || *lex->cur != ',') {
+				report(lex, lex->line, lex->cur - lex->lineStart + 1, "warning: operand %d of %s is missing, 0 assumed", j+1, instr->name);
+				return 0;						// missing operands keep the value 0
+			}
+			lex->cur++;							// remove ','
+			while (lex->cur < lex->end && (*lex->cur == ' ' || *lex->cur == '\t'))
+				lex->cur++;
+		}
+		column = lex->cur - lex->lineStart + 1;
+		if (parseNumber(lex, &number) == 0) {
+			if (number >> instr->maskOperand[j] != 0) {		// wider than its field: it would change other bits
+				report(lex, lex->line, column, "error: operand %d of %s is 0x%lx, it has %d bits (up to 0x%x)", j+1,
+						instr->name, number, instr->maskOperand[j], (1<<instr->maskOperand[j])-1);
+				while (lex->cur < lex->end && *lex->cur != '\n')	// skip the rest of the line
+					lex->cur++;
+				return 1;
+			}
+			operands[j] = number;
+			continue;
+		}
+
+		length = identifierLength(lex->cur, lex->end);		// not a number: it may be a label
+		if (length > 0 && (lex->cur + length == lex->end || lex->cur[length] == ',' || lex->cur[length] == ' ' || lex->cur[length] == '\t'
+				|| lex->cur[length] == '\r' || lex->cur[length] == '\n' || lex->cur[length] == ';')) {
+			if ((index = findSymbol(symbols, lex->cur, length)) < 0)
+				return 17;
+			if (symbols->symbol[index].line != 0)			// already defined: its value is known
+				operands[j] = symbols->symbol[index].value & ((1<<instr->maskOperand[j])-1);
+			else if (addFixup(fixups, address, index, instr, j, lex->line, lex->cur - lex->lineStart + 1) != 0)
+				return 17;
+			lex->cur += length;
+			continue;
+		}
+
+		report(lex, lex->line, lex->cur - lex->lineStart + 1, "error: invalid operand %d of %s (expected .decimal, 0xhex or label)", j+1, instr->name);
+		while (lex->cur < lex->end && *lex->cur != '\n')	// skip the rest of the line
+			lex->cur++;
+		return 1;
+	}
+	return 0;
+}
+
+
+int parseNumber(struct lexer *lex, unsigned long *value) {
+	// reads .decimal or 0xhex up to MAXNUMBER, lex->cur is moved only if the number is valid
+	const char *p = lex->cur;
+	const char *digits;
+	int digit, overflow = 0;
+
+	*value = 0;
+	if (p < lex->end && *p == '.') {			// if the character is '.', the following is a decimal number
+		digits = ++p;
+		for (; p < lex->end && *p >= '0' && *p <= '9'; p++) {
+			digit = *p - '0';
+			if (*value > (MAXNUMBER - digit)/10)
+				overflow = 1;
+			else
+				*value = *value*10 + digit;
+		}
+	}
+	else if (p+1 < lex->end && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {	// if the characters are '0x', the following is a hex number
+		p += 2;
+		digits = p;
+		for (; p < lex->end; p++) {
+			if (*p >= '0' && *p <= '9')			digit = *p - '0';
+			else if (*p >= 'a' && *p <= 'f')	digit = *p - 'a' + 10;
+			else if (*p >= 'A' && *p <= 'F')	digit = *p - 'A' + 10;
+			else break;
+			if (*value > (MAXNUMBER - digit)/16)
+				overflow = 1;
+			else
+				*value = *value*16 + digit;
+		}
+	}
+	else
+		return 1;
+
+	if (p == digits || overflow)				// no digits after '.' or '0x', or too big
+		return 1;
+	if (p < lex->end && *p != ',' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != ';')
+		return 1;								// garbage after number, ex: .12ab
+	lex->cur = p;
+	return 0;
+}
+
+
+void report(const struct lexer *lex, int line, int column, const char *format, ...) {	// prints file:line:column: message
+	va_list args;
+
+	if (lex->messages == NULL)
+		return;
+	va_start(args, format);
+	flockfile(lex->messages);					// threads share stderr: keep each message on its own line
+	fprintf(lex->messages, "%s:%d:%d: ", lex->fileName, line, column);
+	vfprintf(lex->messages, format, args);
+	fputc('\n', lex->messages);
+	funlockfile(lex->messages);
+	va_end(args);
+}
+
+
+int identifierLength(const char *p, const char *end) {	// length of the label name starting at p, 0 if p is not a name
+	const char *start = p;
+
+	if (p >= end || !((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || *p == '_'))
+		return 0;
+	while (p < end && ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_'))
+		p++;
+	return p - start;
+}
+
+
+int findSymbol(struct symbolTable *table, const char *name, int length) {
+	// returns index of the symbol called name, adding it (not defined) if it is new; -1 if there is no memory
+	unsigned int hash = hashName(name, length);
+	int pos, i;
+	int *biggerSlot;
+	struct symbol *biggerSymbol;
+
+	if (2*(table->numSymbols+1) > table->size) {	// keep the table at most half full, rehash with the stored hashes
+		i = (table->size == 0) ? SYMBOLSLOTS : 2*table->size;
+		if ((biggerSlot = (int *)malloc(i*sizeof(int))) == NULL)
+			return -1;
+		free(table->slot);
+		table->slot = biggerSlot;
+		table->size = i;
+		for (i=0; i<table->size; i++)
+			table->slot[i] = EMPTYSLOT;
+		for (i=0; i<table->numSymbols; i++) {
+			pos = table->symbol[i].hash & (table->size-1);
+			while (table->slot[pos] != EMPTYSLOT)
+				pos = (pos+1) & (table->size-1);
+			table->slot[pos] = i;
+		}
+	}
+
+	pos = hash & (table->size-1);
+	while (table->slot[pos] != EMPTYSLOT) {
+		i = table->slot[pos];
+		if (table->symbol[i].hash == hash && table->symbol[i].length == length && memcmp(table->symbol[i].name, name, length) == 0)
+			return i;
+		pos = (pos+1) & (table->size-1);
+	}
+
+	if (table->numSymbols == table->capacity) {
+		i = (table->capacity == 0) ? SYMBOLSLOTS/2 : 2*table->capacity;
+		if ((biggerSymbol = (struct symbol *)realloc(table->symbol, i*sizeof(struct symbol))) == NULL)
+			return -1;
+		table->symbol = biggerSymbol;
+		table->capacity = i;
+	}
+	i = table->numSymbols++;
+	table->symbol[i].name = name;
+	table->symbol[i].length = length;
+	table->symbol[i].hash = hash;
+	table->symbol[i].value = 0;
+	table->symbol[i].line = 0;
+	table->slot[pos] = i;
+	return i;
+}
+
+
+int defineLabel(struct symbolTable *table, struct lexer *lex, const struct token *tok, int length, unsigned long address) {
+	// returns 0 if the label is defined, 1 if it is not valid or already defined, 17 if there is no memory
+	int index;
+
+	if (length == 0 || identifierLength(tok->start, tok->start + length) != length) {
+		report(lex, tok->line, tok->column, "error: invalid label %.*s", tok->length, tok->start);
+		return 1;
+	}
+	if ((index = findSymbol(table, tok->start, length)) < 0)
+		return 17;
+	if (table->symbol[index].line != 0) {
+		report(lex, tok->line, tok->column, "error: label %.*s already defined at line %d", length, tok->start, table->symbol[index].line);
+		return 1;
+	}
+	table->symbol[index].value = address;
+	table->symbol[index].line = tok->line;
+	return 0;
+}
+
+
+int addFixup(struct fixupList *list, unsigned long address, int symbol, const struct instruction *instr, int operand, int line, int column) {
+	struct fixup *bigger;
+	size_t capacity;
+
+	if (list->count == list->capacity) {
+		capacity = (list->capacity == 0) ? 64 : 2*list->capacity;
+		if ((bigger = (struct fixup *)realloc(list->fixup, capacity*sizeof(struct fixup))) == NULL)
+			return 1;
+		list->fixup = bigger;
+		list->capacity = capacity;
+	}
+	list->fixup[list->count].address = address;
+	list->fixup[list->count].symbol = symbol;
+	list->fixup[list->count].shift = instr->shiftOperand[operand];
+	list->fixup[list->count].bits = instr->maskOperand[operand];
+	list->fixup[list->count].line = line;
+	list->fixup[list->count].column = column;
+	list->count++;
+	return 0;
+}
+
+
+void freeSymbols(struct symbolTable *table, struct fixupList *list) {
+	free(table->slot);
+	free(table->symbol);
+	free(list->fixup);
+}
+
+
+int markLine(struct lineMap *lines, int line, int numWords, int flags) {	// returns 0, or 17 if there is no memory
+	struct lineEntry *bigger;
+	int capacity;
+
+	if (line > lines->capacity) {
+		capacity = (lines->capacity == 0) ? 1024 : lines->capacity;
+		while (capacity < line)
+			capacity *= 2;
+		if ((bigger = (struct lineEntry *)realloc(lines->line, capacity*sizeof(struct lineEntry))) == NULL)
+			return 17;
+		lines->line = bigger;
+		lines->capacity = capacity;
+	}
+	if (line > lines->numLines) {
+		memset(&lines->line[lines->numLines], 0, (line - lines->numLines)*sizeof(struct lineEntry));
+		lines->numLines = line;
+	}
+	lines->line[line-1].numWords += numWords;
+	lines->line[line-1].flags |= flags;
+	return 0;
+}
+
+
+int saveSymbols(struct lineMap *lines, const struct symbolTable *table) {	// copy labels defined in lines->symbolData
+	size_t needed = 0;
+	unsigned int value, length;
+	int i;
+
+	for (i=0; i<table->numSymbols; i++)
+		if (table->symbol[i].line != 0)
+			needed += 8 + table->symbol[i].length;
+	if ((lines->symbolData = (char *)malloc(needed + 1)) == NULL)
+		return 17;
+	lines->symbolDataCapacity = needed;
+	for (i=0; i<table->numSymbols; i++) {
+		if (table->symbol[i].line == 0)
+			continue;
+		value = table->symbol[i].value;
+		length = table->symbol[i].length;
+		memcpy(lines->symbolData + lines->symbolDataSize, &value, 4);
+		memcpy(lines->symbolData + lines->symbolDataSize + 4, &length, 4);
+		memcpy(lines->symbolData + lines->symbolDataSize + 8, table->symbol[i].name, length);
+		lines->symbolDataSize += 8 + length;
+		lines->numSymbols++;
+	}
+	return 0;
+}
+
+
+int placeWord(struct memoryImage *image, unsigned long address, unsigned short word) {
+	// returns 0, 1 if a word is already at address, 17 if there is no memory
+	unsigned long number = address / IMAGEPAGEWORDS;
+	struct imagePage *page, **bigger;
+	int low, high, middle, bit;
+
+	if (image->numPages == 0 || image->page[image->last]->number != number) {
+		low = 0;							// binary search of the first page not before number
+		high = image->numPages;
+		while (low < high) {
+			middle = (low + high) / 2;
+			if (image->page[middle]->number < number)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+		if (low == image->numPages || image->page[low]->number != number) {		// new page
+			if (address < image->emitted)	// pages before emitted were full and are gone
+				return 1;
+			if (image->numPages == image->capacity) {
+				high = (image->capacity == 0) ? 16 : 2*image->capacity;
+				if ((bigger = (struct imagePage **)realloc(image->page, high*sizeof(struct imagePage *))) == NULL)
+					return 17;
+				image->page = bigger;
+				image->capacity = high;
+				image->numAllocations++;
+			}
+			if ((page = image->spare) != NULL)
+				image->spare = page->next;
+			else if ((page = (struct imagePage *)malloc(sizeof(struct imagePage))) == NULL)
+				return 17;
+			else
+				image->numAllocations++;
+			page->number = number;
+			memset(page->used, 0, sizeof(page->used));
+			memmove(image->page + low + 1, image->page + low, (image->numPages - low)*sizeof(struct imagePage *));
+			image->page[low] = page;
+			if (++image->numPages > image->maxPages)
+				image->maxPages = image->numPages;
+		}
+		image->last = low;
+	}
+	page = image->page[image->last];
+	bit = address % IMAGEPAGEWORDS;
+	if ((page->used[bit/64] >> (bit%64)) & 1)
+		return 1;
+	page->used[bit/64] |= 1ULL << (bit%64);
+	page->word[bit] = word;
+	image->numWords++;
+	if (address == image->sequence) {		// the sequence goes on, over the words placed ahead of it (org, __config)
+		low = image->last;
+		do {
+			bit = ++image->sequence % IMAGEPAGEWORDS;
+			if (bit == 0 && (++low == image->numPages || image->page[low]->number != image->sequence/IMAGEPAGEWORDS))
+				break;						// nothing placed in the next page
+		} while ((image->page[low]->used[bit/64] >> (bit%64)) & 1);
+	}
+	return 0;
+}
+
+
+unsigned short *findWord(struct memoryImage *image, unsigned long address) {	// the word at address, NULL if none was placed
+	unsigned long number = address / IMAGEPAGEWORDS;
+	int low = 0, high = image->numPages, middle, bit = address % IMAGEPAGEWORDS;
+
+	while (low < high) {
+		middle = (low + high) / 2;
+		if (image->page[middle]->number < number)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	if (low == image->numPages || image->page[low]->number != number || !((image->page[low]->used[bit/64] >> (bit%64)) & 1))
+		return NULL;
+	return &image->page[low]->word[bit];
+}
+
+
+int emitImage(struct memoryImage *image, unsigned long end, struct hexWriter *writer, struct wordBuffer *program) {
+	// streams the runs of words of the pages entirely before address end, in order of address, and frees those pages
+	// a run that doesn't follow the previous one starts a new record; program gets the words of the runs one after the
+	// other (image->run tells where each one is), so it never holds the gaps. Returns 17 if there is no memory
+	struct imagePage *page;
+	struct imageRun *runs;
+	unsigned long start;
+	int i, j, k;
+
+	for (i=0; i<image->numPages && image->page[i]->number < end/IMAGEPAGEWORDS; i++) {
+		page = image->page[i];
+		for (j=0; j<IMAGEPAGEWORDS; j=k) {
+			if (!((page->used[j/64] >> (j%64)) & 1)) {
+				k = j+1;
+				continue;
+			}
+			for (k=j; k<IMAGEPAGEWORDS; k++) {	// end of the run, 64 words at a time when they are all used
+				if (k%64 == 0 && page->used[k/64] == ~0ULL)
+					k += 63;
+				else if (!((page->used[k/64] >> (k%64)) & 1))
+					break;
+			}
+			start = page->number*IMAGEPAGEWORDS + j;
+			if (image->numRuns > 0 && start == image->emitted)
+				image->run[image->numRuns-1].numWords += k - j;
+			else {								// a new run
+				if (image->numRuns == image->maxRuns) {
+					image->maxRuns = (image->maxRuns == 0) ? 16 : 2*image->maxRuns;
+					if ((runs = (struct imageRun *)realloc(image->run, image->maxRuns*sizeof(struct imageRun))) == NULL)
+						return 17;
+					image->run = runs;
+				}
+				image->run[image->numRuns].address = start;
+				image->run[image->numRuns++].numWords = k - j;
+			}
+			if (start != image->emitted && writer != NULL)
+				seekHexWriter(writer, 2*start);
+			if (streamWords(writer, page->word + j, k - j, program) != 0)
+				return 17;
+			image->emitted = start + k - j;
+		}
+		page->next = image->spare;
+		image->spare = page;
+	}
+	memmove(image->page, image->page + i, (image->numPages - i)*sizeof(struct imagePage *));
+	image->numPages -= i;
+	image->last = 0;
+	return 0;
+}
+
+
+void freeImage(struct memoryImage *image) {
+	struct imagePage *page;
+	int i;
+
+	for (i=0; i<image->numPages; i++)
+		free(image->page[i]);
+	while ((page = image->spare) != NULL) {
+		image->spare = page->next;
+		free(page);
+	}
+	free(image->page);
+	free(image->run);
+	memset(image, 0, sizeof(struct memoryImage));
+}
+
+
+int reserveWords(struct wordBuffer *buffer, size_t capacity) {	// make room for at least capacity words
+	unsigned short *bigger;
+
+	if (capacity <= buffer->capacity)
+		return 0;
+	if ((bigger = (unsigned short *)realloc(buffer->word, capacity*sizeof(unsigned short))) == NULL)
+		return 1;
+	buffer->word = bigger;
+	buffer->capacity = capacity;
+	buffer->numAllocations++;
+	return 0;
+}
+
+
+int appendWord(struct wordBuffer *buffer, unsigned short word) {
+	if (buffer->count == buffer->capacity && reserveWords(buffer, (buffer->capacity < 16) ? 16 : 2*buffer->capacity) != 0)
+		return 1;
+	buffer->word[buffer->count++] = word;
+	return 0;
+}
+
+
+void openHexWriter(struct hexWriter *writer, int fd, int recordSize) {	// fd -1: the text is collected in writer->memory
+	writer->fd = fd;
+	writer->textLength = 0;
+	writer->memory = NULL;
+	writer->memoryLength = 0;
+	writer->memoryCapacity = 0;
+	writer->dataLength = 0;
+	writer->recordSize = recordSize;
+	writer->address = 0;
+	writer->upper = 0;
+	writer->sum = 0;
+	writer->numRecords = 0;
+	writer->error = 0;
+	writer->phases = NULL;
+	writeRecord(writer, 4, 0, (const unsigned char *)"\0\0", 2);	// extended linear address: program starts at 0
+}
+
+
+int closeHexWriter(struct hexWriter *writer) {
+	flushRecord(writer);
+	writeRecord(writer, 1, 0, NULL, 0);			// end of file record
+	putHexText(writer, NULL, 0);				// write what is left in text (the file is closed by who opened it)
+	return writer->error;
+}
+
+
+int streamWords(struct hexWriter *writer, const unsigned short *word, size_t count, struct wordBuffer *program) {
+	// returns 17 if program can't store the words
+	size_t i;
+
+	if (writer != NULL)
+		for (i=0; i<count; i++)
+			putHexWord(writer, word[i]);
+	if (program != NULL)						// words wanted in memory, or kept by incremental mode for the cache
+		for (i=0; i<count; i++)
+			if (appendWord(program, word[i]) != 0)
+				return 17;
+	return 0;
+}
+
+
+void seekHexWriter(struct hexWriter *writer, unsigned long address) {	// next bytes go at address, in a new record
+	flushRecord(writer);
+	writer->address = address;				// putHexWord writes the extended linear address record if needed
+}
+
+
+void putHexWord(struct hexWriter *writer, unsigned short word) {	// words are stored low byte first
+	unsigned char byte[2];
+	int i;
+
+	byte[0] = word & 0xff;
+	byte[1] = word >> 8;
+	for (i=0; i<2; i++) {
+		if (writer->dataLength == writer->recordSize)
+			flushRecord(writer);
+		if (writer->dataLength == 0 && (writer->address >> 16) != writer->upper) {
+			unsigned char upper[2] = {(writer->address>>24) & 0xff, (writer->address>>16) & 0xff};
+			writeRecord(writer, 4, 0, upper, 2);		// crossing a 64K boundary (or after a gap): new extended linear address
+			writer->upper = writer->address >> 16;
+		}
+		writer->data[writer->dataLength++] = byte[i];
+		writer->sum += byte[i];					// checksum is computed while bytes arrive
+		writer->address++;
+		if ((writer->address & 0xffff) == 0)	// a record can't go across a 64K boundary
+			flushRecord(writer);
+	}
+}
+
+
+void flushRecord(struct hexWriter *writer) {	// write the data record being filled, if any
+	if (writer->dataLength == 0)
+		return;
+	writeRecord(writer, 0, (writer->address - writer->dataLength) & 0xffff, writer->data, writer->dataLength);
+	writer->numRecords++;
+	writer->dataLength = 0;
+	writer->sum = 0;
+}
+
+
+void writeRecord(struct hexWriter *writer, int type, unsigned int address, const unsigned char *data, int length) {
+	static const char hexDigit[] = "0123456789abcdef";
+	char line[1 + 2*(4+MAXRECORDBYTES+1) + 1];	// ':', length, address, type, data, checksum, '\n'
+	unsigned int sum = length + (address>>8) + (address&0xff) + type;
+	unsigned long long tick = 0;
+	int i, n = 0, timed = 0;
+
+	if (writer->phases != NULL) {				// 1 record in SAMPLEEVERY is timed
+		writer->phases->events[PHASERECORD]++;
+		if ((timed = ((writer->phases->events[PHASERECORD] & (SAMPLEEVERY-1)) == 1)))
+			tick = readTicks();
+	}
+	if (type == 0)
+		sum += writer->sum;						// data bytes have already been added while they were put
+	else
+		for (i=0; i<length; i++)
+			sum += data[i];
+
+	line[n++] = ':';
+	line[n++] = hexDigit[length>>4];
+	line[n++] = hexDigit[length&0xf];
+	line[n++] = hexDigit[(address>>12)&0xf];
+	line[n++] = hexDigit[(address>>8)&0xf];
+	line[n++] = hexDigit[(address>>4)&0xf];
+	line[n++] = hexDigit[address&0xf];
+	line[n++] = hexDigit[type>>4];
+	line[n++] = hexDigit[type&0xf];
+	for (i=0; i<length; i++) {
+		line[n++] = hexDigit[data[i]>>4];
+		line[n++] = hexDigit[data[i]&0xf];
+	}
+	sum = (~sum + 1) & 0xff;					// checksum is 2s complement of the sum of all bytes
+	line[n++] = hexDigit[sum>>4];
+	line[n++] = hexDigit[sum&0xf];
+	line[n++] = '\n';
+	if (timed)
+		lapPhase(writer->phases, PHASERECORD, tick);
+	putHexText(writer, line, n);
+}
+
+
+void putHexText(struct hexWriter *writer, const char *text, int length) {	// length 0 forces a write of pending text
+	ssize_t written;
+	size_t capacity;
+	char *bigger;
+	int done = 0;
+	unsigned long long tick = 0;
+
+	if (length > 0 && writer->textLength + length <= OUTBUFSIZE) {
+		memcpy(writer->text + writer->textLength, text, length);
+		writer->textLength += length;
+		return;
+	}
+	if (writer->phases != NULL)					// every write is timed
+		tick = readTicks();
+	if (writer->fd < 0) {						// in memory: text buffer is appended to memory, which doubles when full
+		if (writer->memoryLength + writer->textLength > writer->memoryCapacity) {
+			capacity = (writer->memoryCapacity == 0) ? 4*OUTBUFSIZE : 2*writer->memoryCapacity;
+			while (capacity < writer->memoryLength + writer->textLength)
+				capacity *= 2;
+			if ((bigger = (char *)realloc(writer->memory, capacity)) == NULL)
+				writer->error = 1;
+			else {
+				writer->memory = bigger;
+				writer->memoryCapacity = capacity;
+			}
+		}
+		if (!writer->error) {
+			memcpy(writer->memory + writer->memoryLength, writer->text, writer->textLength);
+			writer->memoryLength += writer->textLength;
+		}
+		done = writer->textLength;
+	}
+	while (done < writer->textLength) {			// text buffer is full: one big write
+		written = write(writer->fd, writer->text + done, writer->textLength - done);
+		if (written <= 0) {
+			writer->error = 1;
+			break;
+		}
+		done += written;
+	}
+	if (writer->phases != NULL) {
+		writer->phases->events[PHASEWRITE]++;
+		lapPhase(writer->phases, PHASEWRITE, tick);
+	}
+	writer->textLength = 0;
+	if (length > 0) {
+		memcpy(writer->text, text, length);
+		writer->textLength = length;
+	}
+}
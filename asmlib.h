@@ -0,0 +1,237 @@
+/*
+
+Assembler library: assembly source in memory => words or Intel hex text in memory.
+
+	Nothing here opens files or uses global data, so any number of threads can assemble at the same time, sharing
+	one instructionSet (see isa.h). The assembler program is built on top of these functions.
+
+	/// API ///
+	assembleToWords(set, source, size, sourceName, messages, &program, &result)
+		assembles the size bytes of source in program (a wordBuffer, initialized to zeros by the caller and freed
+		with free(program.word)).
+	assembleToHex(set, source, size, sourceName, messages, recordSize, &hex, &hexLength, &result)
+		assembles source in Intel hex text, in data records of recordSize bytes; hex is malloc'ed and must be freed.
+	Both return 0, 17 if there is no memory or 19 if the source has errors (result.numErrors tells how many).
+	program holds the words placed in order of address, one run after the other: addresses skipped by org are not
+	in it (use assembleToHex to know where each word goes).
+	Warnings and errors are printed as "sourceName:line:column: error: ..." on messages (NULL: not printed);
+	sourceName can be NULL, "<memory>" is used.
+
+	assembleSource is the general function used by both and by the assembler program: it sends words to a hexWriter
+	(opened by the caller on a file descriptor, or in memory) and/or to a wordBuffer, and collects for incremental
+	mode what each line of source became.
+
+	Words are placed in a memoryImage, a sparse image of the address space: a sorted array of pages of IMAGEPAGEWORDS
+	words, each with a bitmap of the words placed, so memory is proportional to the words placed and not to the range
+	of addresses (org 0x2100 costs one page, not 8K words). placeWord finds the page of the last word first, so
+	sequential code costs O(1) a word; a word placed twice is an error. emitImage writes the populated runs of
+	words in order of address (each run starts a new record, with an extended linear address record when needed)
+	and frees their pages: the full pages below the first address without a word (code placed in sequence from address
+	0, words placed ahead by org or __config are skipped over once the code reaches them) and before the first label
+	still to be patched are emitted as the source is read, so memory stays bounded; only the pages from the first gap
+	on are held until the end.
+
+	Build: compile asmlib.c and isa.c with the program that uses them.
+
+*/
+
+#ifndef ASMLIB_H
+#define ASMLIB_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "isa.h"
+#include "stats.h"
+
+#define MAXRECORDBYTES 255	// a record can't have more data bytes, its length field is 1 byte
+#define OUTBUFSIZE 65536	// bytes of hex text collected before each write
+#define LINELABEL 1			// flag of lineEntry: the line defines a label
+#define LINEADDRESS 2		// flag of lineEntry: the line places words out of sequence (org, __config)
+#define DIRNONE 0			// values of findDirective
+#define DIRDW 1				// dw word: a word as it is
+#define DIRDE 2				// de byte, byte...: a word for each byte (data EEPROM, after org 0x2100)
+#define DIRORG 3			// org address: next words go at address
+#define DIRCONFIG 4			// __config word: the configuration word at CONFIGADDRESS
+#define CONFIGADDRESS 0x2007	// word address of the configuration word of the PIC16F627A in hex files
+#define MAXNUMBER 0x7fffffff	// largest .decimal or 0xhex number read by parseNumber
+#define IMAGEPAGEWORDS 256	// words of a page of memoryImage, a multiple of 64
+#define PHASEREAD 0			// phases of assembleResult.phases: source read by the program (not by assembleSource)
+#define PHASETOKENIZE 1		// nextToken of instructions and labels (operands are part of encode)
+#define PHASELOOKUP 2		// findInstruction
+#define PHASEENCODE 3		// operands parsed and put in the word
+#define PHASEFIXUPS 4		// uses of labels patched at end of source
+#define PHASEEMIT 5			// words streamed to hexWriter and program, record and write included
+#define PHASERECORD 6		// checksum and hex text of each record
+#define PHASEWRITE 7		// hex text written to the file (or copied to memory)
+#define NUMASMPHASES 8
+
+struct assembleResult {			// what happened assembling one file
+	int status;					// 0 ok, 16 source can't be read, 17 no memory, 18 output can't be written, 19 errors in source
+	int numErrors;				// errors found in source
+	unsigned long numWords;
+	unsigned long numRecords;	// data records written
+	size_t bufferCapacity;		// most words held in memory at the same time (pages of the image)
+	unsigned long numAllocations;	// allocations of pages of the image and of their array
+	struct lookupStats stats;
+	unsigned long numLabels;	// labels defined
+	unsigned long numFixups;	// uses of labels before their definition, patched at end of file
+	int patched;				// 1 if the hex file was patched by incremental mode instead of being written again
+	unsigned long numChangedLines;	// lines assembled again and words rewritten by incremental mode
+	unsigned long numPatchedWords;
+	double seconds;				// wall time spent on the file
+	struct phaseTimer phases;	// filled only if asked to assembleSource, see stats.h
+};
+
+struct wordBuffer {				// assembled program words. Capacity doubles when full, so appends cost O(1) amortized
+	unsigned short *word;
+	size_t count;				// words stored
+	size_t capacity;			// words that fit in the allocated space
+	unsigned long numAllocations;	// malloc/realloc calls made, printed with --stats
+};
+
+struct imagePage {				// IMAGEPAGEWORDS words starting at address number*IMAGEPAGEWORDS
+	unsigned long number;
+	unsigned long long used[IMAGEPAGEWORDS/64];	// bitmap of the words placed
+	unsigned short word[IMAGEPAGEWORDS];
+	struct imagePage *next;		// in the list of spare pages
+};
+
+struct imageRun {				// words emitted one after the other, written in records that follow each other
+	unsigned long address;
+	unsigned long numWords;
+};
+
+struct memoryImage {			// sparse image of the words placed, see above
+	struct imagePage **page;	// pages with at least one word, in order of address
+	int numPages;
+	int capacity;
+	int last;					// page of the last word placed, looked at first
+	int maxPages;				// most pages held at the same time
+	struct imagePage *spare;	// pages emitted, reused before allocating new ones
+	unsigned long numWords;		// words placed
+	unsigned long sequence;		// every address before it has a word: pages before it are full and can be emitted
+	unsigned long emitted;		// address after the last word emitted
+	unsigned long numAllocations;
+	struct imageRun *run;		// runs emitted so far, in order of address
+	int numRuns;
+	int maxRuns;
+};
+
+struct hexWriter {				// Intel hex output, written one record at a time
+	int fd;						// destination file, -1 to collect the text in memory
+	char text[OUTBUFSIZE];		// hex text waiting to be written
+	int textLength;
+	char *memory;				// whole hex text when fd is -1
+	size_t memoryLength;
+	size_t memoryCapacity;
+	unsigned char data[MAXRECORDBYTES];	// data bytes of the record being filled
+	int dataLength;
+	int recordSize;				// data bytes of a full record
+	unsigned long address;		// address of next data byte
+	unsigned long upper;		// upper 16 bits of address in the last extended linear address record
+	unsigned int sum;			// sum of data bytes of current record, checksum is completed when the record is written
+	unsigned long numRecords;	// data records written, printed with --stats
+	int error;					// 1 if a write failed
+	struct phaseTimer *phases;	// if not NULL, records and writes are timed here
+};
+
+struct lexer {					// position of the lexer in the source
+	const char *cur;			// next character to examine
+	const char *end;			// one past the last character of the file
+	const char *lineStart;		// first character of current line, used to get columns
+	int line;					// current line, starting from 1
+	const char *fileName;		// used in messages
+	FILE *messages;				// where warnings and errors are printed, NULL for nowhere
+};
+
+struct token {					// a token is a span of the source, it is never copied or terminated with '\0'
+	const char *start;
+	int length;
+	int line;
+	int column;
+};
+
+struct symbol {					// a label: its name is not copied, it points to the first occurrence in the source
+	const char *name;
+	int length;
+	unsigned int hash;
+	unsigned long value;		// address of the word following the definition
+	int line;					// line of the definition, 0 if the label is only used so far
+};
+
+struct symbolTable {			// open addressing hash index over symbols, grows with the source
+	int size;					// number of slots, always a power of 2
+	int *slot;					// each slot holds an index of symbol or EMPTYSLOT
+	struct symbol *symbol;		// symbols in order of first occurrence
+	int numSymbols;
+	int capacity;
+};
+
+struct fixup {					// an operand that uses a label not defined yet
+	unsigned long address;		// word to patch
+	int symbol;					// index of symbol in symbolTable
+	unsigned char shift;		// position and size of the operand in the word
+	unsigned char bits;
+	unsigned short column;		// where the label was used, for the error if it is never defined
+	int line;
+};
+
+struct fixupList {				// fixups in order of address. Capacity doubles when full
+	struct fixup *fixup;
+	size_t count;
+	size_t capacity;
+};
+
+struct lineEntry {				// what a line of source became, as kept in the cache of incremental mode
+	unsigned int hash;			// hash of the text of the line, without '\n'
+	unsigned short numWords;	// words assembled from the line
+	unsigned short flags;		// LINELABEL
+};
+
+struct lineMap {				// collected by assembleSource in incremental mode, to write the cache
+	struct lineEntry *line;		// line[i] is line i+1 of the source
+	int numLines;
+	int capacity;
+	struct wordBuffer words;	// the words of all the runs, one run after the other (gaps are not stored)
+	struct imageRun *run;		// runs of words written in the hex file, malloc'ed
+	int numRuns;
+	char *symbolData;			// labels defined: value (4 bytes), length of name (4 bytes) and name of each one
+	size_t symbolDataSize;
+	size_t symbolDataCapacity;
+	int numSymbols;
+};
+
+int assembleToWords(const struct instructionSet*, const char*, size_t, const char*, FILE*, struct wordBuffer*, struct assembleResult*);
+int assembleToHex(const struct instructionSet*, const char*, size_t, const char*, FILE*, int, char**, size_t*, struct assembleResult*);
+int assembleSource(const struct instructionSet*, const char*, size_t, const char*, FILE*, struct hexWriter*, struct wordBuffer*, struct lineMap*, struct assembleResult*, int);
+void initLexer(struct lexer*, const char*, size_t, const char*, FILE*);
+int nextToken(struct lexer*, struct token*);
+int encodeInstruction(const struct instruction*, struct lexer*, struct symbolTable*, struct fixupList*, unsigned long, unsigned short*);
+int findDirective(const struct token*);
+int parseDirective(struct lexer*, int, int, unsigned long*);
+int parseOperands(struct lexer*, const struct instruction*, int*, struct symbolTable*, struct fixupList*, unsigned long);
+int parseNumber(struct lexer*, unsigned long*);
+void report(const struct lexer*, int, int, const char*, ...);
+int identifierLength(const char*, const char*);
+int findSymbol(struct symbolTable*, const char*, int);
+int defineLabel(struct symbolTable*, struct lexer*, const struct token*, int, unsigned long);
+int addFixup(struct fixupList*, unsigned long, int, const struct instruction*, int, int, int);
+void freeSymbols(struct symbolTable*, struct fixupList*);
+int markLine(struct lineMap*, int, int, int);
+int saveSymbols(struct lineMap*, const struct symbolTable*);
+int placeWord(struct memoryImage*, unsigned long, unsigned short);
+unsigned short *findWord(struct memoryImage*, unsigned long);
+int emitImage(struct memoryImage*, unsigned long, struct hexWriter*, struct wordBuffer*);
+void freeImage(struct memoryImage*);
+int reserveWords(struct wordBuffer*, size_t);
+int appendWord(struct wordBuffer*, unsigned short);
+void openHexWriter(struct hexWriter*, int, int);
+int closeHexWriter(struct hexWriter*);
+int streamWords(struct hexWriter*, const unsigned short*, size_t, struct wordBuffer*);
+void seekHexWriter(struct hexWriter*, unsigned long);
+void putHexWord(struct hexWriter*, unsigned short);
+void flushRecord(struct hexWriter*);
+void writeRecord(struct hexWriter*, int, unsigned int, const unsigned char*, int);
+void putHexText(struct hexWriter*, const char*, int);
+
+#endif
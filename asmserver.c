@@ -0,0 +1,514 @@
+/*
+
+Assembler and disassembler server: the instruction set is loaded once and requests are served on a Unix socket.
+
+	/// USAGE ///
+	asmserver [-j workers] [-s socket] instructionSet
+	 -j workers		threads that assemble and disassemble (default: number of cores).
+	 -s socket		Unix socket to listen on (default /tmp/asmserver.sock). A socket left by a server that is not
+					running anymore is removed; if a server is still answering on it, this one exits with 18.
+	The server runs until it gets SIGINT or SIGTERM, then removes the socket and prints how many requests it served.
+	Requests and responses are described in protocol.h; asmclient sends them from the command line.
+
+	/// DESIGN ///
+	One thread runs the event loop: it accepts connections and reads and writes all of them with poll, never blocking
+	on a client. When a whole request has been read it is put in a queue and the connection is not read any more until
+	its response is written, so responses come in the order of requests. Worker threads take requests from the queue and
+	call the libraries (asmlib.c, dislib.c) on the data in memory, sharing the instruction set read only; when a response
+	is ready they wake the event loop through a pipe.
+	Build with: gcc -O2 -pthread asmserver.c asmlib.c dislib.c protocol.c isa.c stats.c -o asmserver (or make)
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "isa.h"
+#include "asmlib.h"
+#include "dislib.h"
+#include "protocol.h"
+
+#define HELP "Usage: asmserver [-j workers] [-s socket] instructionSet\n"
+#define RECORDBYTES 16		// default number of data bytes of a hex record
+#define READCHUNK 65536		// bytes read from a client at a time
+#define READING 0			// states of a connection
+#define WORKING 1
+#define WRITING 2
+
+struct connection {				// a client, owned by the event loop except its response while it is WORKING
+	int fd;
+	int state;					// READING, WORKING (a worker has its request) or WRITING
+	char *in;					// bytes received, the request being served is at the beginning
+	size_t inLength;
+	size_t inCapacity;
+	size_t requestLength;		// bytes of in taken by the request being served
+	char *out;					// response being written
+	size_t outLength;
+	size_t outSent;
+	int closeAfter;				// 1 if the connection is closed when the response is written
+	struct connection *next;	// next request in the queue of workers
+};
+
+struct server {					// everything shared by event loop and workers
+	const struct instructionSet *set;
+	pthread_mutex_t lock;		// protects queue, states of connections and stopping
+	pthread_cond_t hasRequests;
+	struct connection *first;	// queue of requests waiting for a worker
+	struct connection *last;
+	int wakePipe[2];			// workers write a byte in wakePipe[1] when a response is ready
+	int stopping;
+	unsigned long numRequests;
+	struct connection **clients;	// all connections, used only by the event loop while it runs
+	int numClients;
+	int maxClients;
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+static int signalWakeFd = -1;	// the signal handler wakes poll too, even if the signal comes just before it is called
+
+void onSignal(int);
+int listenOn(const char*);
+int eventLoop(struct server*, int);
+int readClient(struct server*, struct connection*);
+int writeClient(struct server*, struct connection*);
+void takeRequest(struct server*, struct connection*);
+void closeConnection(struct connection*);
+void *serverWorker(void*);
+void serveRequest(const struct instructionSet*, struct connection*);
+int setResponse(struct connection*, int, const char*, size_t, const char*, size_t);
+
+
+int main (int argc, char* argv[]) {
+	struct instructionSet instructionSet;	// loaded once, then only read by all workers
+	struct server server;
+	const char *socketName = DEFAULTSOCKET;
+	int numWorkers = 0;						// 0 = number of cores
+	int i, listenFd, status;
+	pthread_t *workers;
+	struct sigaction action;
+	sigset_t stopSignals, oldSignals;
+
+	/***********		Read options		************/
+	while (argc > 2 && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-j") == 0)
+			numWorkers = atoi(argv[2]);
+		else if (strcmp(argv[1], "-s") == 0)
+			socketName = argv[2];
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc != 2) {
+		printf(HELP);
+		return 0;
+	}
+	if (numWorkers <= 0)
+		numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	/***********		Load instruction set, with decode table for disassembly		************/
+	status = loadInstructionSet(argv[1], &instructionSet, 1);
+	if (status == 1) {
+		printf("Invalid instruction set file %s.\n", argv[1]);
+		return 14;
+	}
+	else if (status != 0) {
+		printf("Not enough memory to load the instruction set.\n");
+		return 17;
+	}
+
+	/***********		Socket, pipe and workers		************/
+	if ((listenFd = listenOn(socketName)) < 0) {
+		printf("Can't listen on %s%s.\n", socketName, (listenFd == -2) ? ": a server is already running" : "");
+		freeInstructionSet(&instructionSet);
+		return 18;
+	}
+	memset(&server, 0, sizeof(server));
+	server.set = &instructionSet;
+	if (pipe(server.wakePipe) != 0) {
+		printf("Can't create a pipe.\n");
+		close(listenFd);
+		unlink(socketName);
+		freeInstructionSet(&instructionSet);
+		return 18;
+	}
+	fcntl(server.wakePipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(server.wakePipe[1], F_SETFL, O_NONBLOCK);	// a full pipe already holds a wake-up, workers never wait on it
+	pthread_mutex_init(&server.lock, NULL);
+	pthread_cond_init(&server.hasRequests, NULL);
+	signalWakeFd = server.wakePipe[1];
+
+	memset(&action, 0, sizeof(action));			// no SA_RESTART: poll returns EINTR and the loop ends
+	action.sa_handler = onSignal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);					// clients that go away are seen as write errors
+	sigemptyset(&stopSignals);
+	sigaddset(&stopSignals, SIGINT);
+	sigaddset(&stopSignals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stopSignals, &oldSignals);	// workers inherit the mask: signals reach the event loop
+	workers = (pthread_t *)malloc(numWorkers*sizeof(pthread_t));
+	for (i=0; workers != NULL && i<numWorkers; i++)
+		if (pthread_create(&workers[i], NULL, serverWorker, &server) != 0)
+			break;
+	numWorkers = (workers == NULL) ? 0 : i;
+	pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+
+	/***********		Serve until stopped		************/
+	if (numWorkers == 0) {
+		printf("Can't start workers.\n");
+		status = 17;
+	}
+	else {
+		printf("Listening on %s with %d workers.\n", socketName, numWorkers);
+		fflush(stdout);
+		status = eventLoop(&server, listenFd);
+	}
+
+	pthread_mutex_lock(&server.lock);
+	server.stopping = 1;						// workers finish the request they have and stop, queued requests are dropped
+	pthread_cond_broadcast(&server.hasRequests);
+	pthread_mutex_unlock(&server.lock);
+	for (i=0; i<numWorkers; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+	for (i=0; i<server.numClients; i++)
+		closeConnection(server.clients[i]);
+	free(server.clients);
+	close(listenFd);
+	unlink(socketName);
+	close(server.wakePipe[0]);
+	close(server.wakePipe[1]);
+	pthread_cond_destroy(&server.hasRequests);
+	pthread_mutex_destroy(&server.lock);
+	freeInstructionSet(&instructionSet);
+	if (status == 0)
+		printf("%lu requests served.\n", server.numRequests);
+	return status;
+}
+
+
+// FUNCTIONS DEFINITION
+void onSignal(int signalNumber) {
+	ssize_t written = 0;
+
+	(void)signalNumber;
+	stopRequested = 1;
+	if (signalWakeFd >= 0)
+		written = write(signalWakeFd, "", 1);	// write is async-signal-safe
+	(void)written;
+}
+
+
+int listenOn(const char *socketName) {
+	// returns the listening socket (non blocking), -1 on error, -2 if another server answers on socketName
+	struct sockaddr_un address;
+	int fd;
+
+	if (strlen(socketName) >= sizeof(address.sun_path))
+		return -1;
+	if ((fd = connectServer(socketName)) >= 0) {
+		close(fd);
+		return -2;
+	}
+	unlink(socketName);							// left by a server that was killed
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketName);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+		close(fd);
+		return -1;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return fd;
+}
+
+
+int eventLoop(struct server *server, int listenFd) {	// returns 0 when stopped by a signal, 17 if there is no memory
+	struct connection **clients, **biggerClients;
+	struct pollfd *polled = NULL, *biggerPolled;
+	int *polledClient = NULL, *biggerIndex;	// polledClient[k] is the index in clients of polled[k]
+	int i, k, numPolled, fd, state, status = 0;
+	char drain[256];
+
+	while (!stopRequested) {
+		if (server->numClients + 2 >= server->maxClients) {	// room for all clients, listening socket, pipe and a new client
+			server->maxClients = (server->maxClients == 0) ? 64 : 2*server->maxClients;
+			biggerClients = (struct connection **)realloc(server->clients, server->maxClients*sizeof(struct connection *));
+			biggerPolled = (struct pollfd *)realloc(polled, server->maxClients*sizeof(struct pollfd));
+			biggerIndex = (int *)realloc(polledClient, server->maxClients*sizeof(int));
+			if (biggerClients != NULL)
+				server->clients = biggerClients;
+			if (biggerPolled != NULL)
+				polled = biggerPolled;
+			if (biggerIndex != NULL)
+				polledClient = biggerIndex;
+			if (biggerClients == NULL || biggerPolled == NULL || biggerIndex == NULL) {
+				status = 17;
+				break;
+			}
+		}
+		clients = server->clients;
+
+		polled[0].fd = listenFd;
+		polled[0].events = POLLIN;
+		polled[1].fd = server->wakePipe[0];
+		polled[1].events = POLLIN;
+		numPolled = 2;
+		pthread_mutex_lock(&server->lock);		// states are changed by workers
+		for (i=0; i<server->numClients; i++) {
+			if (clients[i]->state == WORKING)
+				continue;
+			polled[numPolled].fd = clients[i]->fd;
+			polled[numPolled].events = (clients[i]->state == READING) ? POLLIN : POLLOUT;
+			polledClient[numPolled++] = i;
+		}
+		pthread_mutex_unlock(&server->lock);
+		for (k=0; k<numPolled; k++)
+			polled[k].revents = 0;
+
+		if (poll(polled, numPolled, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			status = 18;
+			break;
+		}
+
+		if (polled[1].revents & POLLIN)			// responses ready: they are polled for writing next time
+			while (read(server->wakePipe[0], drain, sizeof(drain)) > 0)
+				;
+		for (k=2; k<numPolled; k++) {
+			if (polled[k].revents == 0)
+				continue;
+			i = polledClient[k];
+			pthread_mutex_lock(&server->lock);
+			state = clients[i]->state;
+			pthread_mutex_unlock(&server->lock);
+			if ((state == READING && readClient(server, clients[i]) != 0) || (state == WRITING && writeClient(server, clients[i]) != 0)) {
+				closeConnection(clients[i]);
+				clients[i] = NULL;					// removed after this pass, indexes in polledClient stay valid
+			}
+		}
+		for (i=k=0; i<server->numClients; i++)
+			if (clients[i] != NULL)
+				clients[k++] = clients[i];
+		server->numClients = k;
+
+		if (polled[0].revents & POLLIN)			// new clients, as many as there is room for
+			while (server->numClients + 2 < server->maxClients && (fd = accept(listenFd, NULL, NULL)) >= 0) {
+				fcntl(fd, F_SETFL, O_NONBLOCK);
+				if ((clients[server->numClients] = (struct connection *)calloc(1, sizeof(struct connection))) == NULL) {
+					close(fd);
+					break;
+				}
+				clients[server->numClients++]->fd = fd;
+			}
+	}
+	free(polled);
+	free(polledClient);
+	return status;
+}
+
+
+int readClient(struct server *server, struct connection *client) {	// returns 1 if the connection must be closed
+	ssize_t numRead;
+	size_t capacity;
+	char *bigger;
+
+	if (client->inLength + READCHUNK > client->inCapacity) {
+		capacity = (client->inCapacity == 0) ? 4*READCHUNK : 2*client->inCapacity;
+		if ((bigger = (char *)realloc(client->in, capacity)) == NULL)
+			return 1;
+		client->in = bigger;
+		client->inCapacity = capacity;
+	}
+	numRead = read(client->fd, client->in + client->inLength, READCHUNK);
+	if (numRead < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (numRead <= 0)							// client closed the connection
+		return 1;
+	client->inLength += numRead;
+	takeRequest(server, client);
+	return 0;
+}
+
+
+int writeClient(struct server *server, struct connection *client) {	// returns 1 if the connection must be closed
+	ssize_t written;
+
+	written = send(client->fd, client->out + client->outSent, client->outLength - client->outSent, MSG_NOSIGNAL);
+	if (written < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (written <= 0)
+		return 1;
+	client->outSent += written;
+	if (client->outSent < client->outLength)
+		return 0;
+
+	free(client->out);							// response written: next request, which may already be in
+	client->out = NULL;
+	if (client->closeAfter)
+		return 1;
+	client->inLength -= client->requestLength;
+	memmove(client->in, client->in + client->requestLength, client->inLength);
+	client->requestLength = 0;
+	client->state = READING;
+	takeRequest(server, client);
+	return 0;
+}
+
+
+void takeRequest(struct server *server, struct connection *client) {
+	// if in holds a whole request, it is queued for the workers; an invalid request is answered at once
+	const unsigned char *header = (const unsigned char *)client->in;
+	size_t nameLength, dataLength;
+
+	if (client->inLength < REQUESTHEADER)
+		return;
+	nameLength = header[2] | (header[3]<<8);
+	dataLength = getLittle32(header + 4);
+	if ((header[0] != REQASSEMBLE && header[0] != REQDISASSEMBLE) || nameLength > MAXNAME || dataLength > MAXREQUEST) {
+		client->closeAfter = 1;
+		if (setResponse(client, BADREQUEST, NULL, 0, "invalid request\n", 16) != 0)
+			client->outLength = 0;				// nothing to say: the connection is just closed
+		client->state = WRITING;
+		return;
+	}
+	if (client->inLength < REQUESTHEADER + nameLength + dataLength)
+		return;
+	client->requestLength = REQUESTHEADER + nameLength + dataLength;
+	pthread_mutex_lock(&server->lock);
+	client->state = WORKING;
+	client->next = NULL;
+	if (server->last == NULL)
+		server->first = client;
+	else
+		server->last->next = client;
+	server->last = client;
+	pthread_cond_signal(&server->hasRequests);
+	pthread_mutex_unlock(&server->lock);
+}
+
+
+void closeConnection(struct connection *client) {
+	close(client->fd);
+	free(client->in);
+	free(client->out);
+	free(client);
+}
+
+
+void *serverWorker(void *arg) {
+	struct server *server = (struct server *)arg;
+	struct connection *client;
+	ssize_t written;
+
+	for (;;) {
+		pthread_mutex_lock(&server->lock);
+		while (server->first == NULL && !server->stopping)
+			pthread_cond_wait(&server->hasRequests, &server->lock);
+		if (server->stopping) {
+			pthread_mutex_unlock(&server->lock);
+			return NULL;
+		}
+		client = server->first;
+		server->first = client->next;
+		if (server->first == NULL)
+			server->last = NULL;
+		pthread_mutex_unlock(&server->lock);
+
+		serveRequest(server->set, client);
+
+		pthread_mutex_lock(&server->lock);
+		client->state = WRITING;
+		server->numRequests++;
+		pthread_mutex_unlock(&server->lock);
+		written = write(server->wakePipe[1], "", 1);	// if the pipe is full the event loop is already awake
+		(void)written;
+	}
+}
+
+
+void serveRequest(const struct instructionSet *set, struct connection *client) {
+	// assembles or disassembles the request at the beginning of client->in and puts the response in client->out
+	const unsigned char *header = (const unsigned char *)client->in;
+	size_t nameLength = header[2] | (header[3]<<8);
+	size_t dataLength = getLittle32(header + 4);
+	const char *data = client->in + REQUESTHEADER + nameLength;
+	int recordSize = header[1] ? header[1] : RECORDBYTES;
+	char name[MAXNAME+1];
+	char *messages = NULL, *hex = NULL;
+	size_t messagesLength = 0, hexLength = 0;
+	FILE *messageFile;
+	struct assembleResult result;
+	struct textBuffer text = {NULL, 0, 0, 0};
+	struct recordError *errors = NULL;
+	int i, numErrors = 0, status;
+
+	memcpy(name, client->in + REQUESTHEADER, nameLength);
+	name[nameLength] = '\0';
+	if ((messageFile = open_memstream(&messages, &messagesLength)) == NULL) {
+		if (setResponse(client, 17, NULL, 0, NULL, 0) != 0)
+			client->closeAfter = 1;
+		return;
+	}
+
+	if (header[0] == REQASSEMBLE) {
+		status = assembleToHex(set, data, dataLength, name, messageFile, recordSize, &hex, &hexLength, &result);
+		if (status == 19)
+			fprintf(messageFile, "%d errors found.\n", result.numErrors);
+	}
+	else {
+		status = disassembleHex(set, data, dataLength, 1, (header[1] == OPERANDHEX) ? OPERANDHEX : OPERANDDECIMAL, NULL, &text,
+				&errors, &numErrors, NULL);	// workers already run in parallel
+		for (i=0; i<numErrors; i++)
+			fprintf(messageFile, "%s:%d: error: %s\n", name, errors[i].line, recordErrorText(errors[i].code));
+		free(errors);
+		if (status == 17) {						// text may be partial
+			free(text.text);
+			text.text = NULL;
+			text.length = 0;
+		}
+	}
+	fclose(messageFile);
+
+	if (setResponse(client, status, (header[0] == REQASSEMBLE) ? hex : text.text, (header[0] == REQASSEMBLE) ? hexLength : text.length,
+			messages, messagesLength) != 0 && setResponse(client, 17, NULL, 0, NULL, 0) != 0)
+		client->closeAfter = 1;					// not even an empty response: the client sees the connection closed
+	free(hex);
+	free(text.text);
+	free(messages);
+}
+
+
+int setResponse(struct connection *client, int status, const char *output, size_t outputLength, const char *messages, size_t messagesLength) {
+	// returns 17 if there is no memory for the response
+	unsigned char *header;
+
+	client->outLength = RESPONSEHEADER + outputLength + messagesLength;
+	client->outSent = 0;
+	if ((client->out = (char *)malloc(client->outLength)) == NULL) {
+		client->outLength = 0;
+		return 17;
+	}
+	header = (unsigned char *)client->out;
+	memset(header, 0, RESPONSEHEADER);
+	header[0] = status;
+	putLittle32(header + 4, outputLength);
+	putLittle32(header + 8, messagesLength);
+	if (outputLength > 0)
+		memcpy(client->out + RESPONSEHEADER, output, outputLength);
+	if (messagesLength > 0)
+		memcpy(client->out + RESPONSEHEADER + outputLength, messages, messagesLength);
+	return 0;
+}
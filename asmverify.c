@@ -0,0 +1,792 @@
+/*
+
+Round-trip verifier and differential fuzzer of assembler and disassembler: everything is done in memory with asmlib.c
+and dislib.c, the same code used by the programs.
+
+	/// USAGE ///
+	asmverify [-j threads] [-n programs] [-t seconds] [-l lines] [-s seed] instructionSet [file.asm ...]
+	 -j threads		threads running random programs (default: number of cores).
+	 -n programs	number of random programs (default 100000, 0 for none).
+	 -t seconds		run random programs for this time instead of a number of them.
+	 -l lines		longest random program (default 32 lines).
+	 -s seed		seed of random programs (default 1): the same seed gives the same programs.
+
+	/// CHECKS ///
+	 words			each of the 2^14 words is disassembled, with decimal and hex operands, and assembled again.
+					A word that comes back different only in bits that belong to no field of its instruction (ex: the
+					low bits of clrw, or bits 8-9 of movlw) is an alias: the hardware ignores those bits, so aliases
+					are counted and listed by instruction but are not failures. Any other difference is a failure.
+	 files			each file is assembled in Intel hex, disassembled with labels (see dislib.h) and assembled again;
+					the two must have the same words at the same addresses. Only the addresses in the hex file are
+					compared, not the ones skipped by org.
+	 random			programs of random instructions, operands (decimal or hex, any case), labels used before and after
+					their definition, dw, de, org, __config, blanks and comments are generated with the words they must
+					become at each address. Each is assembled and compared with those words (differential check of the
+					assembler), then disassembled with labels and assembled again (round trip). A failing program is
+					minimized, removing lines as long as it fails in the same way, and printed with the first address
+					that differs.
+	Failures are printed as they are found (the first MAXREPORTS random ones in full); at the end a summary of each
+	check is printed. The program returns 0 if nothing failed, VERIFYFAILED otherwise.
+	Build with: gcc -O2 -pthread asmverify.c asmlib.c dislib.c isa.c stats.c -o asmverify (or make)
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "isa.h"
+#include "asmlib.h"
+#include "dislib.h"
+
+#define HELP "Usage: asmverify [-j threads] [-n programs] [-t seconds] [-l lines] [-s seed] instructionSet [file.asm ...]\n"
+#define VERIFYFAILED 22		// returned when some check failed
+#define MAXREPORTS 10		// random failures printed in full
+#define MAXLINES 4096		// longest random program
+#define PROGRAMBATCH 256	// random programs taken at a time by a thread
+#define ITEMLABEL 0			// kinds of line of a random program
+#define ITEMINSTRUCTION 1
+#define ITEMDATA 2
+#define ITEMORG 3
+#define ITEMCONFIG 4
+#define ITEMDE 5
+#define ORGSPACE 4096		// words skipped by all the org of a random program, at most: code stays below CONFIGADDRESS
+#define VERIFYWORDS (CONFIGADDRESS+1)	// addresses a random program can use
+#define NOFAILURE 0			// results of checkProgram
+#define ASSEMBLEFAILED 1	// the source has errors, or doesn't give the words it should
+#define ROUNDTRIPFAILED 2	// words disassembled and assembled again are different
+#define NOWORD 0x10000		// in place of a word missing from a program
+
+struct item {					// one line of a random program
+	int kind;					// ITEMLABEL, ITEMINSTRUCTION, ITEMDATA, ITEMORG, ITEMCONFIG or ITEMDE
+	int index;					// instruction, number of the label defined, value of dw or __config, words skipped
+								// by org or number of bytes of de
+	int operand[2];				// numbers written as operands (bytes of de)...
+	int label[2];				// ...or labels used in their place (-1 for a number)
+	unsigned char style[8];		// random choices of how the line is written: blanks, hex or decimal, case, comment
+};
+
+struct program {
+	struct item item[MAXLINES];
+	int count;
+	int numLabels;				// labels are numbered from 0
+};
+
+struct fuzz {					// everything shared by the workers
+	const struct instructionSet *set;
+	unsigned long long seed;
+	int maxLines;
+	unsigned long numPrograms;	// programs to run, 0 if limited by time
+	double endTime;
+	unsigned long nextProgram;	// first program not taken yet, protected by lock
+	unsigned long programsDone;
+	unsigned long wordsDone;
+	unsigned long numFailed;
+	pthread_mutex_t lock;
+};
+
+struct worker {					// a thread running random programs, with its buffers reused by every program
+	struct fuzz *fuzz;
+	char *source;
+	size_t sourceCapacity;
+	unsigned int expected[VERIFYWORDS];	// word expected at each address, NOWORD if none
+	size_t expectedEnd;			// one past the highest address expected
+	size_t numExpected;			// words expected
+	int labelValue[MAXLINES];	// address of each label, -1 if its definition is not in the program
+	struct wordImage words;		// program assembled from source
+	struct wordImage again;		// program assembled from its disassembly
+	struct textBuffer text;		// disassembly
+	struct program candidate;	// program being minimized
+};
+
+struct failure {				// first difference found by checkProgram
+	unsigned long address;
+	unsigned int expected;		// word that should be there
+	unsigned int found;			// word that is there (NOWORD if there is none)
+	int numErrors;				// errors of the assembler
+};
+
+
+int verifyWords(const struct instructionSet*);
+int verifyFile(const struct instructionSet*, const char*);
+void *fuzzWorker(void*);
+void generateProgram(struct program*, const struct instructionSet*, unsigned long long*, int);
+int renderProgram(const struct program*, const struct instructionSet*, struct worker*);
+void expectWord(struct worker*, size_t, unsigned int);
+int checkProgram(const struct program*, const struct instructionSet*, int, struct worker*, struct failure*);
+void minimizeProgram(struct program*, const struct instructionSet*, int, int, struct worker*);
+void reportFailure(unsigned long, const struct program*, int, int, struct worker*);
+int assembleText(const struct instructionSet*, const char*, size_t, struct wordBuffer*, int*);
+int assembleImage(const struct instructionSet*, const char*, size_t, struct wordImage*, int*);
+size_t findDifference(const struct wordImage*, const struct wordImage*, size_t);
+size_t nextImageWord(const struct wordImage*, const struct wordImage*, size_t);
+unsigned int imageWord(const struct wordImage*, size_t);
+int isAlias(const struct instructionSet*, unsigned int, unsigned int);
+const char *wordText(char*, unsigned int);
+unsigned long long nextRandom(unsigned long long*);
+int readFile(const char*, char**, size_t*);
+double wallTime(void);
+
+
+int main (int argc, char* argv[]) {
+	struct instructionSet instructionSet;
+	struct fuzz fuzz;
+	struct worker *workers;
+	pthread_t *threads;
+	int i, numThreads = 0, numFailed = 0;
+	double seconds = 0, start;
+
+	/***********		Read options		************/
+	memset(&fuzz, 0, sizeof(fuzz));
+	fuzz.numPrograms = 100000;
+	fuzz.maxLines = 32;
+	fuzz.seed = 1;
+	while (argc > 2 && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-j") == 0)
+			numThreads = atoi(argv[2]);
+		else if (strcmp(argv[1], "-n") == 0)
+			fuzz.numPrograms = strtoul(argv[2], NULL, 10);
+		else if (strcmp(argv[1], "-t") == 0)
+			seconds = atof(argv[2]);
+		else if (strcmp(argv[1], "-l") == 0)
+			fuzz.maxLines = atoi(argv[2]);
+		else if (strcmp(argv[1], "-s") == 0)
+			fuzz.seed = strtoull(argv[2], NULL, 10);
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 2 || argv[1][0] == '-' || fuzz.maxLines < 1 || fuzz.maxLines > MAXLINES) {
+		printf(HELP);
+		return 0;
+	}
+	if (loadInstructionSet(argv[1], &instructionSet, 1) != 0) {	// decode table is needed too
+		printf("Invalid instruction set file %s.\n", argv[1]);
+		return 16;
+	}
+	fuzz.set = &instructionSet;
+
+	/***********		All words		************/
+	numFailed += verifyWords(&instructionSet);
+
+	/***********		Files		************/
+	for (i=2; i<argc; i++)
+		numFailed += verifyFile(&instructionSet, argv[i]);
+
+	/***********		Random programs		************/
+	if (fuzz.numPrograms > 0 || seconds > 0) {
+		if (numThreads <= 0)
+			numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+		start = wallTime();
+		if (seconds > 0) {
+			fuzz.numPrograms = 0;
+			fuzz.endTime = start + seconds;
+		}
+		threads = (pthread_t *)malloc(numThreads*sizeof(pthread_t));
+		workers = (struct worker *)calloc(numThreads, sizeof(struct worker));
+		if (threads == NULL || workers == NULL) {
+			printf("Not enough memory.\n");
+			return 17;
+		}
+		pthread_mutex_init(&fuzz.lock, NULL);
+		for (i=0; i<numThreads; i++) {
+			workers[i].fuzz = &fuzz;
+			pthread_create(&threads[i], NULL, fuzzWorker, &workers[i]);
+		}
+		for (i=0; i<numThreads; i++)
+			pthread_join(threads[i], NULL);
+		pthread_mutex_destroy(&fuzz.lock);
+		seconds = wallTime() - start;
+		printf("random: %lu programs, %lu words, %d threads, %.3f s (%.0f programs/s), %lu failed.\n", fuzz.programsDone,
+				fuzz.wordsDone, numThreads, seconds, fuzz.programsDone/seconds, fuzz.numFailed);
+		numFailed += fuzz.numFailed;
+		for (i=0; i<numThreads; i++) {
+			free(workers[i].source);
+			freeWordImage(&workers[i].words);
+			freeWordImage(&workers[i].again);
+			free(workers[i].text.text);
+		}
+		free(workers);
+		free(threads);
+	}
+
+	freeInstructionSet(&instructionSet);
+	return (numFailed > 0) ? VERIFYFAILED : 0;
+}
+
+
+// FUNCTIONS DEFINITION
+int verifyWords(const struct instructionSet *set) {
+	// disassembles and assembles again every word; returns the number of words that failed
+	struct textBuffer text = {NULL, 0, 0, 0};
+	struct wordBuffer program = {NULL, 0, 0, 0};
+	const struct decodeEntry *entry;
+	unsigned long *numAliases;			// words with bits outside the fields of each instruction...
+	unsigned short *aliasWord;			// ...and the first of them
+	unsigned short word;
+	int style, status, numErrors, numFailed = 0, total = 0, i;
+
+	numAliases = (unsigned long *)calloc(set->numInstructions, sizeof(unsigned long));
+	aliasWord = (unsigned short *)calloc(set->numInstructions, sizeof(unsigned short));
+	if (numAliases == NULL || aliasWord == NULL) {
+		printf("Not enough memory.\n");
+		return 1;
+	}
+	for (style=OPERANDDECIMAL; style<=OPERANDHEX; style++) {
+		for (i=0; i<NUMWORDS; i++) {
+			word = i;
+			text.length = 0;
+			disassembleWords(set, &word, 1, style, &text);
+			status = assembleText(set, text.text, text.length, &program, &numErrors);
+			if (status == 0 && program.count == 1 && program.word[0] == word)
+				continue;
+			entry = &set->decodeTable[word];
+			if (status == 0 && program.count == 1 && isAlias(set, word, program.word[0])) {
+				if (style == OPERANDDECIMAL && numAliases[entry->opIndex]++ == 0)
+					aliasWord[entry->opIndex] = word;	// same words come back in both styles: counted once
+				continue;
+			}
+			if (numFailed++ < MAXREPORTS) {
+				if (status != 0 || program.count != 1)
+					printf("words: 0x%04x disassembled as \"%.*s\" can't be assembled.\n", word, (int)text.length-1, text.text);
+				else
+					printf("words: 0x%04x disassembled as \"%.*s\" assembled back as 0x%04x.\n", word, (int)text.length-1,
+							text.text, program.word[0]);
+			}
+		}
+	}
+	for (i=0; i<set->numInstructions; i++)
+		total += numAliases[i];
+	printf("words: %d words, decimal and hex operands, %d failed, %d aliases.\n", NUMWORDS, numFailed, total);
+	for (i=0; i<set->numInstructions; i++) {
+		if (numAliases[i] == 0)
+			continue;
+		text.length = 0;
+		word = aliasWord[i];
+		disassembleWords(set, &word, 1, OPERANDDECIMAL, &text);
+		assembleText(set, text.text, text.length, &program, &numErrors);
+		printf("  %s: %lu words with bits outside its fields, ex: 0x%04x => 0x%04x\n", set->instr[i].name, numAliases[i],
+				word, program.word[0]);
+	}
+	free(numAliases);
+	free(aliasWord);
+	free(text.text);
+	free(program.word);
+	return numFailed;
+}
+
+
+int verifyFile(const struct instructionSet *set, const char *fileName) {
+	// assembles fileName, disassembles it with labels and assembles it again; returns 1 if the programs are different
+	struct wordImage first = {NULL, 0, 0, 0, 0}, again = {NULL, 0, 0, 0, 0};
+	struct textBuffer text = {NULL, 0, 0, 0};
+	unsigned short word;
+	char *source, found[12];
+	size_t size, i;
+	int numErrors, numFailed = 0;
+
+	if (readFile(fileName, &source, &size) != 0) {
+		printf("%s: can't be read.\n", fileName);
+		return 1;
+	}
+	if (assembleImage(set, source, size, &first, &numErrors) != 0) {
+		printf("%s: %d errors, not verified.\n", fileName, numErrors);
+		free(source);
+		freeWordImage(&first);
+		return 1;
+	}
+	free(source);
+	if (disassembleLabelled(set, &first, OPERANDDECIMAL, &text, NULL) != 0
+			|| assembleImage(set, text.text, text.length, &again, &numErrors) != 0) {
+		printf("%s: the disassembly can't be assembled (%d errors).\n", fileName, numErrors);
+		numFailed = 1;
+	}
+	else {
+		for (i=0; (i = findDifference(&first, &again, i)) != (size_t)-1; i++) {
+			if (numFailed++ >= MAXREPORTS)
+				continue;
+			if (imageWord(&first, i) == NOWORD) {
+				printf("%s: address 0x%04lx: not in the program, assembled back as 0x%04x.\n", fileName,
+						(unsigned long)i, imageWord(&again, i));
+				continue;
+			}
+			text.length = 0;
+			word = imageWord(&first, i);
+			disassembleWords(set, &word, 1, OPERANDDECIMAL, &text);
+			printf("%s: address 0x%04lx: 0x%04x disassembled as \"%.*s\" assembled back as %s.\n", fileName,
+					(unsigned long)i, word, (int)text.length-1, text.text, wordText(found, imageWord(&again, i)));
+		}
+	}
+	printf("%s: %lu words, %d failed.\n", fileName, first.numWords, numFailed);
+	freeWordImage(&first);
+	freeWordImage(&again);
+	free(text.text);
+	return numFailed > 0;
+}
+
+
+void *fuzzWorker(void *arg) {
+	struct worker *worker = (struct worker *)arg;
+	struct fuzz *fuzz = worker->fuzz;
+	struct program *program;
+	struct failure failure;
+	unsigned long first, count, p, numWords;
+	unsigned long long state;
+	int kind;
+
+	if ((program = (struct program *)malloc(sizeof(struct program))) == NULL)
+		return NULL;
+	for (;;) {
+		pthread_mutex_lock(&fuzz->lock);	// take a batch of programs
+		first = fuzz->nextProgram;
+		count = PROGRAMBATCH;
+		if (fuzz->numPrograms > 0 && first + count > fuzz->numPrograms)
+			count = (first < fuzz->numPrograms) ? fuzz->numPrograms - first : 0;
+		else if (fuzz->numPrograms == 0 && wallTime() >= fuzz->endTime)
+			count = 0;
+		fuzz->nextProgram += count;
+		pthread_mutex_unlock(&fuzz->lock);
+		if (count == 0)
+			break;
+
+		numWords = 0;
+		for (p=first; p<first+count; p++) {
+			state = fuzz->seed*0x9e3779b97f4a7c15ULL + p;	// each program has its own sequence: it can be made again
+			generateProgram(program, fuzz->set, &state, fuzz->maxLines);
+			kind = checkProgram(program, fuzz->set, p & 1, worker, &failure);	// odd programs are disassembled in hex
+			numWords += worker->numExpected;
+			if (kind != NOFAILURE)
+				reportFailure(p, program, kind, p & 1, worker);
+		}
+		pthread_mutex_lock(&fuzz->lock);
+		fuzz->programsDone += count;
+		fuzz->wordsDone += numWords;
+		pthread_mutex_unlock(&fuzz->lock);
+	}
+	free(program);
+	return NULL;
+}
+
+
+void generateProgram(struct program *program, const struct instructionSet *set, unsigned long long *state, int maxLines) {
+	struct item *item;
+	const struct instruction *instr;
+	unsigned long long r;
+	int i, j, hasConfig = 0;
+
+	program->count = 1 + nextRandom(state) % maxLines;
+	program->numLabels = 0;
+	for (i=0; i<program->count; i++) {		// kind of each line: 1 in 8 is a label, 1 in 16 is dw, 1 in 32 org or de
+		item = &program->item[i];
+		r = nextRandom(state);
+		memcpy(item->style, &r, sizeof(item->style));
+		r = nextRandom(state);
+		if ((r & 31) < 4) {
+			item->kind = ITEMLABEL;
+			item->index = program->numLabels++;
+		}
+		else if ((r & 31) < 6) {
+			item->kind = ITEMDATA;
+			item->index = (r >> 8) & 0xffff;
+		}
+		else if ((r & 31) == 6) {			// only forward, so no address is used twice
+			item->kind = ITEMORG;
+			item->index = (r >> 8) % (1 + ORGSPACE/maxLines);
+		}
+		else if ((r & 31) == 7) {
+			item->kind = ITEMDE;
+			item->index = 1 + ((r >> 8) & 1);
+			item->operand[0] = (r >> 16) & 0xff;
+			item->operand[1] = (r >> 24) & 0xff;
+		}
+		else if ((r & 31) == 8 && !hasConfig) {	// the configuration word can be placed once
+			item->kind = ITEMCONFIG;
+			item->index = (r >> 8) & 0x3fff;
+			hasConfig = 1;
+		}
+		else {
+			item->kind = ITEMINSTRUCTION;
+			item->index = (r >> 8) % set->numInstructions;
+		}
+	}
+	for (i=0; i<program->count; i++) {		// operands: numbers, or 1 in 4 a label defined before or after
+		item = &program->item[i];
+		if (item->kind != ITEMINSTRUCTION)
+			continue;
+		instr = &set->instr[item->index];
+		for (j=0; j<2; j++) {
+			r = nextRandom(state);
+			item->operand[j] = (j < instr->numOperands) ? (r & ((1<<instr->maskOperand[j])-1)) : 0;
+			item->label[j] = (j < instr->numOperands && program->numLabels > 0 && ((r >> 32) & 3) == 0)
+					? (int)((r >> 34) % program->numLabels) : -1;
+		}
+	}
+}
+
+
+static int putNumber(char *text, int value, int style) {
+	// writes value as the assembler reads it, .decimal or 0xhex, with random case and leading zeros
+	if (style & 1)
+		return sprintf(text, (style & 2) ? ((style & 4) ? "0X%04X" : "0X%X") : ((style & 4) ? "0x%04x" : "0x%x"), value);
+	return sprintf(text, (style & 4) ? ".%03d" : ".%d", value);
+}
+
+
+int renderProgram(const struct program *program, const struct instructionSet *set, struct worker *worker) {
+	// writes the source of program in worker->source and the words it must become in worker->expected;
+	// returns the length of the source, -1 if there is no memory
+	static const char *indent[] = {"", " ", "\t", "  \t"};
+	const struct item *item;
+	const struct instruction *instr;
+	char *text, *bigger;
+	size_t capacity = program->count*96 + 1;
+	int i, j, value, address = 0;
+	unsigned int word;
+
+	if (capacity > worker->sourceCapacity) {
+		if ((bigger = (char *)realloc(worker->source, capacity)) == NULL)
+			return -1;
+		worker->source = bigger;
+		worker->sourceCapacity = capacity;
+	}
+	for (i=0; i<program->numLabels; i++)	// a label that was removed while minimizing has no value
+		worker->labelValue[i] = -1;
+	for (i=0; i<program->count; i++) {
+		item = &program->item[i];
+		if (item->kind == ITEMLABEL)
+			worker->labelValue[item->index] = address;
+		else if (item->kind == ITEMORG || item->kind == ITEMDE)
+			address += item->index;
+		else if (item->kind != ITEMCONFIG)
+			address++;
+	}
+
+	text = worker->source;
+	worker->expectedEnd = 0;
+	worker->numExpected = 0;
+	address = 0;
+	for (i=0; i<program->count; i++) {
+		item = &program->item[i];
+		if (item->kind == ITEMLABEL) {
+			text += sprintf(text, "%sL%d:", (item->style[0] & 4) ? "\t" : "", item->index);
+		}
+		else if (item->kind == ITEMORG) {
+			address += item->index;
+			text += sprintf(text, "%s%s ", indent[item->style[0] & 3], (item->style[1] & 4) ? "ORG" : "org");
+			text += putNumber(text, address, item->style[2]);
+		}
+		else if (item->kind == ITEMDATA || item->kind == ITEMCONFIG) {
+			text += sprintf(text, "%s%s ", indent[item->style[0] & 3], (item->kind == ITEMDATA)
+					? ((item->style[1] & 4) ? "DW" : "dw") : ((item->style[1] & 4) ? "__CONFIG" : "__config"));
+			text += putNumber(text, item->index, item->style[2]);
+			expectWord(worker, (item->kind == ITEMDATA) ? address++ : CONFIGADDRESS, item->index);
+		}
+		else if (item->kind == ITEMDE) {
+			text += sprintf(text, "%s%s ", indent[item->style[0] & 3], (item->style[1] & 4) ? "DE" : "de");
+			for (j=0; j<item->index; j++) {
+				if (j > 0)
+					text += sprintf(text, (item->style[1] & 2) ? ", " : ",");
+				text += putNumber(text, item->operand[j], item->style[2+j]);
+				expectWord(worker, address++, item->operand[j]);
+			}
+		}
+		else {
+			instr = &set->instr[item->index];
+			word = instr->opCode << instr->shiftOpCode;
+			text += sprintf(text, "%s%s", indent[item->style[0] & 3], instr->name);
+			for (j=0; j<instr->numOperands; j++) {
+				if (j == 0)
+					*text++ = (item->style[1] & 1) ? '\t' : ' ';
+				else
+					text += sprintf(text, (item->style[1] & 2) ? ", " : ",");
+				if (item->label[j] >= 0 && worker->labelValue[item->label[j]] >= 0) {
+					text += sprintf(text, "L%d", item->label[j]);
+					value = worker->labelValue[item->label[j]] & ((1<<instr->maskOperand[j])-1);
+				}
+				else {								// a number, or 0 in place of a label that was removed
+					value = (item->label[j] >= 0) ? 0 : item->operand[j];
+					text += putNumber(text, value, item->style[2+j]);
+				}
+				word |= value << instr->shiftOperand[j];
+			}
+			expectWord(worker, address++, word);
+		}
+		if (item->style[4] & 1)
+			text += sprintf(text, "%s; comment", (item->style[4] & 2) ? "\t" : " ");
+		*text++ = (item->style[5] & 1) ? '\r' : '\n';	// some lines end as in Windows
+		if (item->style[5] & 1)
+			*text++ = '\n';
+	}
+	return text - worker->source;
+}
+
+
+void expectWord(struct worker *worker, size_t address, unsigned int word) {	// addresses skipped before it are NOWORD
+	while (worker->expectedEnd < address)
+		worker->expected[worker->expectedEnd++] = NOWORD;
+	worker->expected[address] = word;
+	if (address == worker->expectedEnd)
+		worker->expectedEnd++;
+	worker->numExpected++;
+}
+
+
+int checkProgram(const struct program *program, const struct instructionSet *set, int style, struct worker *worker,
+		struct failure *failure) {
+	// assembles program and compares it with the words expected, then disassembles it with labels and assembles it
+	// again; returns NOFAILURE, ASSEMBLEFAILED or ROUNDTRIPFAILED, with the first difference in failure
+	int length;
+	size_t i;
+
+	memset(failure, 0, sizeof(struct failure));
+	if ((length = renderProgram(program, set, worker)) < 0)
+		return NOFAILURE;					// no memory: not a failure of the programs
+	if (assembleImage(set, worker->source, length, &worker->words, &failure->numErrors) != 0)
+		return (failure->numErrors > 0) ? ASSEMBLEFAILED : NOFAILURE;
+	for (i=0; i<worker->expectedEnd; i++) {
+		if (imageWord(&worker->words, i) != worker->expected[i]) {
+			failure->address = i;
+			failure->expected = worker->expected[i];
+			failure->found = imageWord(&worker->words, i);
+			return ASSEMBLEFAILED;
+		}
+	}
+	if ((i = nextImageWord(&worker->words, NULL, worker->expectedEnd)) != (size_t)-1) {
+		failure->address = i;				// a word after the last one expected
+		failure->expected = NOWORD;
+		failure->found = imageWord(&worker->words, i);
+		return ASSEMBLEFAILED;
+	}
+
+	worker->text.length = 0;
+	if (disassembleLabelled(set, &worker->words, style, &worker->text, NULL) != 0)
+		return NOFAILURE;
+	if (assembleImage(set, worker->text.text, worker->text.length, &worker->again, &failure->numErrors) != 0)
+		return (failure->numErrors > 0) ? ROUNDTRIPFAILED : NOFAILURE;
+	if ((i = findDifference(&worker->words, &worker->again, 0)) != (size_t)-1) {
+		failure->address = i;
+		failure->expected = imageWord(&worker->words, i);
+		failure->found = imageWord(&worker->again, i);
+		return ROUNDTRIPFAILED;
+	}
+	return NOFAILURE;
+}
+
+
+void minimizeProgram(struct program *program, const struct instructionSet *set, int style, int kind, struct worker *worker) {
+	// removes lines from program as long as it fails in the same way: blocks of half the lines, then a quarter...
+	struct program *candidate = &worker->candidate;
+	struct failure failure;
+	int chunk, start, length;
+
+	for (chunk=program->count/2; chunk>=1; chunk/=2) {
+		for (start=0; start<program->count; ) {
+			length = (start + chunk <= program->count) ? chunk : program->count - start;	// lines removed
+			memcpy(candidate->item, program->item, start*sizeof(struct item));
+			memcpy(candidate->item + start, program->item + start + length, (program->count - start - length)*sizeof(struct item));
+			candidate->count = program->count - length;
+			candidate->numLabels = program->numLabels;
+			if (candidate->count > 0 && checkProgram(candidate, set, style, worker, &failure) == kind) {
+				memcpy(program->item, candidate->item, candidate->count*sizeof(struct item));
+				program->count = candidate->count;
+			}
+			else
+				start += chunk;
+		}
+	}
+}
+
+
+void reportFailure(unsigned long number, const struct program *failed, int kind, int style, struct worker *worker) {
+	// counts a failed random program and prints the first MAXREPORTS ones, minimized
+	struct fuzz *fuzz = worker->fuzz;
+	struct program *program;
+	struct failure failure;
+	struct textBuffer text = {NULL, 0, 0, 0};
+	unsigned short word;
+	unsigned long numFailed;
+	const char *line;
+	char expected[12], found[12];
+	int length;
+
+	pthread_mutex_lock(&fuzz->lock);
+	numFailed = ++fuzz->numFailed;
+	pthread_mutex_unlock(&fuzz->lock);
+	if (numFailed > MAXREPORTS || (program = (struct program *)malloc(sizeof(struct program))) == NULL)
+		return;
+	memcpy(program, failed, sizeof(struct program));
+	minimizeProgram(program, fuzz->set, style, kind, worker);
+	checkProgram(program, fuzz->set, style, worker, &failure);	// source and failure of the minimized program
+	length = renderProgram(program, fuzz->set, worker);
+
+	flockfile(stdout);						// one report at a time
+	printf("random: program %lu of seed %llu %s, %d lines left:\n", number, fuzz->seed,
+			(kind == ASSEMBLEFAILED) ? "is not assembled as expected" : "changes after disassembly and assembly", program->count);
+	for (line=worker->source; line<worker->source + length; ) {
+		printf("    %.*s\n", (int)strcspn(line, "\r\n"), line);
+		line += strcspn(line, "\n") + 1;
+	}
+	if (failure.numErrors > 0)
+		printf("    %d errors found by the assembler.\n", failure.numErrors);
+	else if (kind == ASSEMBLEFAILED)
+		printf("    address 0x%04lx: expected %s, assembled %s.\n", failure.address, wordText(expected, failure.expected),
+				wordText(found, failure.found));
+	else if (failure.expected == NOWORD)
+		printf("    address 0x%04lx: not in the program, assembled back as %s.\n", failure.address,
+				wordText(found, failure.found));
+	else {
+		word = failure.expected;
+		disassembleWords(fuzz->set, &word, 1, style, &text);
+		printf("    address 0x%04lx: 0x%04x disassembled as \"%.*s\", assembled back as %s.\n", failure.address,
+				failure.expected, (int)text.length-1, text.text, wordText(found, failure.found));
+		free(text.text);
+	}
+	funlockfile(stdout);
+	free(program);
+}
+
+
+int assembleText(const struct instructionSet *set, const char *text, size_t size, struct wordBuffer *program, int *numErrors) {
+	// assembles text in program (emptied first, its space is reused); returns as assembleToWords
+	struct assembleResult result;
+
+	program->count = 0;
+	assembleToWords(set, text, size, "<verify>", NULL, program, &result);
+	*numErrors = result.numErrors;
+	return result.status;
+}
+
+
+int assembleImage(const struct instructionSet *set, const char *text, size_t size, struct wordImage *image, int *numErrors) {
+	// assembles text in Intel hex and reads it back in image (emptied first), so only the
+	// addresses placed are there; returns as assembleToHex
+	struct assembleResult result;
+	struct recordError *errors;
+	char *hex;
+	size_t length;
+	int numCorrupted;
+
+	freeWordImage(image);
+	*numErrors = 0;
+	if (assembleToHex(set, text, size, "<verify>", NULL, 16, &hex, &length, &result) != 0) {
+		*numErrors = result.numErrors;
+		return result.status;
+	}
+	result.status = readHexWords(hex, length, image, &errors, &numCorrupted);
+	free(errors);
+	free(hex);
+	return result.status;
+}
+
+
+size_t findDifference(const struct wordImage *first, const struct wordImage *again, size_t address) {
+	// first address from address on with a different word (or a word in only one of them), (size_t)-1 if none
+	size_t one = nextImageWord(first, again, address), other = nextImageWord(again, first, address);
+
+	return (one < other) ? one : other;
+}
+
+
+size_t nextImageWord(const struct wordImage *image, const struct wordImage *other, size_t address) {
+	// first address from address on with a word of image that other doesn't have (any word if other is NULL),
+	// (size_t)-1 if none; only the pages of image are looked at
+	const struct wordPage *page;
+	int low = 0, high = image->numPages, middle, o;
+
+	while (low < high) {					// binary search of the first page not before address
+		middle = (low + high) / 2;
+		if (image->page[middle]->number < address/WORDPAGEWORDS)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	for (; low<image->numPages; low++) {
+		page = image->page[low];
+		o = (page->number == address/WORDPAGEWORDS) ? address % WORDPAGEWORDS : 0;
+		for (; o<WORDPAGEWORDS; o++) {
+			if (!((page->present[o/64] >> (o%64)) & 1))
+				continue;
+			address = page->number*WORDPAGEWORDS + o;
+			if (other == NULL || imageWord(other, address) != page->word[o])
+				return address;
+		}
+	}
+	return (size_t)-1;
+}
+
+
+unsigned int imageWord(const struct wordImage *image, size_t address) {	// the word at address, NOWORD if there is none
+	int word = findImageWord(image, address);
+
+	return (word < 0) ? NOWORD : (unsigned int)word;
+}
+
+
+int isAlias(const struct instructionSet *set, unsigned int word, unsigned int again) {
+	// 1 if word is an instruction and again differs from it only in bits used by neither its opcode nor its operands
+	const struct instruction *instr;
+	unsigned int mask;
+	int j;
+
+	if (word >= NUMWORDS || set->decodeTable[word].opIndex == INVALIDOP)
+		return 0;
+	instr = &set->instr[set->decodeTable[word].opIndex];
+	mask = (NUMWORDS-1) & ~((1u<<instr->shiftOpCode)-1);	// opcode: from its shift up to the last bit
+	for (j=0; j<instr->numOperands; j++)
+		mask |= ((1u<<instr->maskOperand[j])-1) << instr->shiftOperand[j];
+	return ((word ^ again) & mask) == 0;
+}
+
+
+const char *wordText(char *text, unsigned int word) {	// "0x...." or "no word" for NOWORD
+	if (word == NOWORD)
+		return "no word";
+	sprintf(text, "0x%04x", word);
+	return text;
+}
+
+
+unsigned long long nextRandom(unsigned long long *state) {	// splitmix64: any state, even 0, gives a good sequence
+	unsigned long long z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+
+int readFile(const char *fileName, char **data, size_t *size) {
+	FILE *filePtr;
+	char *bigger;
+	size_t capacity = 65536;
+
+	if ((filePtr = (strcmp(fileName, "-") == 0) ? stdin : fopen(fileName, "rb")) == NULL)
+		return 1;
+	*size = 0;
+	*data = NULL;
+	do {									// works for pipes too
+		capacity *= 2;
+		if ((bigger = (char *)realloc(*data, capacity)) == NULL) {
+			free(*data);
+			if (filePtr != stdin)
+				fclose(filePtr);
+			return 1;
+		}
+		*data = bigger;
+		*size += fread(*data + *size, 1, capacity - *size, filePtr);
+	} while (*size == capacity);
+	if (filePtr != stdin)
+		fclose(filePtr);
+	return 0;
+}
+
+
+double wallTime(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec*1e-9;
+}
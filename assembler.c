@@ -33,182 +33,927 @@ Next, each row corresponds to an instruction.
 
 An instruction set file for pic16f672a is provided. It is named: pic16f672a_InS.txt
 
+The instruction set can be compiled with isacompiler (pic16f627a_InS.txt => pic16f627a_InS.bin): if the compiled file
+is next to the text file and is not older than it, it is memory mapped instead of parsing the text (see isa.h).
+A compiled file can also be passed directly in place of the text file.
+
+	/// ASSEMBLY FILE ///
+	Each instruction is its name followed by its operands separated by ',' (ex: btfsc 0x12,.3).
+	Operands are decimal numbers if they start with '.', hex numbers if they start with '0x'. A number wider than its
+	operand (ex: bit .9 of bsf, which has 3 bits) is an error.
+	Missing trailing operands are assumed to be 0. Text from ';' to end of line is a comment.
+	Tokens that are not instructions (ex: END) are skipped, except these directives (in any case):
+	 dw word		puts word (up to 0xffff) in a word as it is, as the disassembler prints words that are not instructions.
+	 org address	the next words go at address (ex: org 0x4 for the interrupt vector).
+	 __config word	puts word (up to 0x3fff) at 0x2007, the address of the configuration word in hex files.
+	 de byte,...	puts each byte (up to 0xff) in a word: data EEPROM, after org 0x2100.
+	A word placed twice at the same address is an error.
+
+	/// LABELS ///
+	A label is defined by a name followed by ':' (ex: loop:) anywhere, or by a name starting in column 1 that is not an
+	instruction (ex: loop  decfsz 0x20,.1). Names are made of letters, digits and '_' and don't start with a digit.
+	The value of a label is the address of the next instruction, and a label can be used as operand in place of a number
+	(ex: goto loop), masked to the operand size. The source is read only once: names are kept in a hash table that points
+	to their first occurrence in the source, and every use of a label not defined yet is recorded as a fixup (address of
+	word, label, operand position). Words are streamed to the hex file up to the first fixup, the others are kept until
+	the end of the file, when all fixups are patched.
+	Errors are reported as file:line:column; if there are errors no output file is created.
+	The file is memory mapped when possible, otherwise (ex: a pipe, or '-' for standard input) it is read in memory.
+
+	/// OPTIONS ///
+	Options can be passed before the 2 files:
+	 --stats		print on standard output (standard error if the hex file is written there), instead of "File created",
+					a JSON object with the time of each phase (read, tokenize, lookup, encode, fixups, emit, record, write)
+					and counters: mnemonic lookups, misses and hash slots probed, words, records, labels, fixups...
+					Phases done once per token or record are timed on 1 item in 64 and estimated; without --stats
+					nothing is timed. In batch mode the object holds the totals of all files.
+	 -o file		write the assembled code in file instead of hexFormatProgram.txt ('-' is standard output).
+	 -r bytes		number of data bytes of each hex record, from 1 to 255 (default 16).
+	 --batch		assemble many files: every argument after the instruction set is a file to assemble, or @list where
+					list is a file containing one file name per line. Each file.asm is assembled in file.hex.
+	 -j threads		number of threads used by --batch (default: number of cores).
+	 -i				incremental mode, see below (also with --batch).
+
+	/// BATCH MODE ///
+	The instruction set is loaded once and shared, read only, by all threads. Each thread takes files from its own
+	queue; when it is empty it steals half of the files left in the longest queue of another thread.
+	An error in a file doesn't stop the others. When all files are done, one line per file is printed in the order
+	they were passed, with words assembled and time taken. The program returns 19 if at least one file failed.
+	Build with: gcc -O2 -pthread assembler.c asmlib.c isa.c stats.c source.c -o assembler (or make)
+
+	/// INCREMENTAL MODE ///
+	With -i, next to the hex file a cache is kept (hexFile.cache) with, for each line of the source, a hash of its text,
+	how many words it made and if it defines a label or uses org/__config, followed by the words of the hex file (only
+	the ones placed, run after run, so org 0x7ffffff0 costs nothing), the values of the labels and the runs of words
+	with their address, their first word in the cache and the position of their first record.
+	Next time the source is hashed line by line and only lines whose hash changed are assembled again: if they make the
+	same number of words, don't define labels and use only known labels, the new words are written over the old ones in
+	the hex file and only the records that contain them are rewritten, with their checksum; the cache is updated in place.
+	Unchanged org lines are read again to follow the address. Otherwise (lines added or removed, labels moved, changed
+	lines with directives, different instruction set or record size, hex file changed by someone else...) the whole file
+	is assembled again and the cache is rewritten.
+
 	/// OUTPUT ///
-	Output of this program will be a file named hexFormatProgram.txt, in which there will be the assembled code (hex format).
+	Output of this program will be a file named hexFormatProgram.txt, in which there will be the assembled code (Intel hex format).
+	Words are placed in a sparse image (see asmlib.h) and written in order of address, in data records of 16 bytes (or
+	the size passed with -r); addresses where nothing was placed are not written, each populated run starts a new
+	record. Code placed in sequence from address 0 is streamed to the file while the source is assembled, so memory used
+	doesn't depend on program size; a __config or an org ahead only holds back the pages from the first gap on. An extended linear
+	address record is written at the beginning and every time the address crosses a 64K boundary.
+
+	/// LIBRARY ///
+	Assembling itself is done by asmlib.c on a source in memory (see asmlib.h): this program only reads files, writes
+	the hex file and its cache and runs --batch.
 
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+#include "isa.h"
+#include "asmlib.h"
+#include "source.h"
 
-//#define DEBUG		// uncomment to debug
-#define HELP "You need to pass 2 files as arguments:\n 1st file must contain the instruction set;\n 2nd file has to be assembly code to translate in hex format.\n"
+#define HELP "You need to pass 2 files as arguments:\n 1st file must contain the instruction set;\n 2nd file has to be assembly code to translate in hex format.\nOptions:\n --stats  print time of each phase and counters as JSON.\n -o file  output file (default hexFormatProgram.txt, '-' for standard output).\n -r bytes data bytes per hex record, 1-255 (default 16).\n --batch  assemble every following file (or @list of files) into file.hex.\n -j n     threads used by --batch.\n -i       incremental: patch the hex file using its cache when only some lines changed.\n"
+#define RECORDBYTES 16		// default number of data bytes of a hex record
+#define DEFAULTOUTPUT "hexFormatProgram.txt"
+#define MAXPATH 4096		// longest file name accepted in a --batch list
+#define CACHEMAGIC "PICASMC\n"	// first 8 bytes of a cache file of incremental mode
+#define CACHEVERSION 4
+#define CACHESUFFIX ".cache"
+#define EXTRECORDTEXT 16	// characters of an extended linear address record, ":02000004xxxxcc\n"
 
-struct instruction {
-	char name[10];				// name of instruction, ex: movf
-	int numOperands;			// how many operands the instruction needs. Ex: movf f,d => 2 operands
-	int maskOperand[2];			// each element is a mask of a number of '1' corresponding to operand size -- ex: 1010010 => mask is: 111 1111 => number of ones is: 7
-	int shiftOperand[2];		// each element is how many right shifts are required to use the corresponding mask
-	int opCode;					// it represents opcode
-	int shiftOpCode;			// how many right shifts are required to extract only opcode from instruction
+struct jobQueue {				// files assigned to one thread of --batch: the owner takes them from head,
+	pthread_mutex_t lock;		// idle threads steal them from tail
+	int head;
+	int tail;					// files from head to tail-1 are still to do
 };
 
-int acquireInstruction(FILE*, struct instruction *);
-int printInstruction(struct instruction);
-int swapData(short*);
+struct batch {					// everything shared by the threads of --batch
+	const struct instructionSet *set;
+	char **sources;
+	char **outputs;
+	struct assembleResult *results;	// results[i] belongs to sources[i], so the report keeps the order of arguments
+	int recordSize;
+	int incremental;			// 1 if files are assembled with assembleIncremental
+	int timePhases;				// 1 if phases are timed for --stats
+	int numWorkers;
+	struct jobQueue *queue;		// one queue per thread
+};
 
-union instrWord	{				// each word of 2 bytes corresponds to an instruction
-	short fullWord;				// fullWord is used to access to the full word
-	char byteWord[2];			// byteWord[0] and byteWord[1] are used to access first byte and second byte of word
+struct worker {					// argument of a --batch thread
+	struct batch *batch;
+	int id;
 };
 
+struct cacheHeader {			// header of the cache file, followed by lines, words, symbolData and runs
+	char magic[8];				// CACHEMAGIC
+	unsigned int version;		// CACHEVERSION
+	unsigned int isaHash;		// hash of the instructions used to assemble the words
+	unsigned int recordSize;
+	unsigned int numLines;
+	unsigned int numWords;
+	unsigned int numSymbols;
+	unsigned int symbolDataSize;
+	unsigned int numRuns;
+	long long outputSize;		// size and modification time of the hex file when it was written: if they don't
+	long long outputSec;		// match, the file was changed by something else and is assembled again
+	long long outputNsec;
+};
+
+struct cacheRun {				// a run of words of the hex file (see asmlib.h) and where its first data record is
+	unsigned long long address;
+	unsigned long long numWords;
+	unsigned long long index;	// position of its first word in the words of the cache
+	long long offset;
+};
+
+struct wordPatch {				// a word whose value changed, written over the old one in the hex file
+	unsigned long address;
+	unsigned long index;		// position in the words of the cache
+	int run;					// run of the hex file it belongs to
+	unsigned short word;
+};
+
+int printInstruction(struct instruction);
+int assembleFile(const struct instructionSet*, const char*, const char*, int, struct assembleResult*, struct lineMap*, int);
+int assembleIncremental(const struct instructionSet*, const char*, const char*, int, struct assembleResult*, int);
+int patchOutput(const struct instructionSet*, const struct sourceText*, const char*, const unsigned int*, int, const char*, const char*, int, struct assembleResult*);
+int writeCache(const char*, const char*, const struct instructionSet*, int, const unsigned int*, int, struct lineMap*);
+unsigned int *hashLines(const struct sourceText*, int*);
+int findRun(const struct cacheRun*, int, unsigned long);
+off_t recordOffset(unsigned long, const struct cacheRun*, int, int*);
+off_t runText(unsigned long, unsigned long, int);
+int patchRecord(int, off_t, unsigned char*, int);
+void printStats(FILE*, const struct instructionSet*, const struct assembleResult*, double, struct tickClock*);
+int runBatch(const struct instructionSet*, char**, int, int, int, int, int, struct assembleResult*);
+void *batchWorker(void*);
+int takeJob(struct batch*, int);
+int readFileList(const char*, char***, int*, int*);
+int addSource(const char*, char***, int*, int*);
+char *hexNameFor(const char*);
+double wallTime(void);
+
 
 int main (int argc, char* argv[]) {
-	FILE *filePtr;
-	int i,j = 0, numInstructions;
-	char c, acquiredOpName[10];			// temp variable to store instruction acquired from asm file
-	int index;							// variable in which index of current instruction from instructionSet will be stored
-	int operands[2] = {0,0};			// vector containing operands values obtained from asm file
-	int numWords = 0;
-	unsigned short hexInstruction;
-	unsigned short *finalProgramWord;
-	unsigned int checksum=0;
-
-	/***********		Check if the file could be opened		************/
-	if ((filePtr=fopen(argv[1], "r"))==NULL) {		// argv[1] will be the instruction set
-		printf("Invalid file.\n" HELP);
+	struct instructionSet instructionSet;	// loaded once, then only read
+	struct assembleResult result;
+	const char *outputName = DEFAULTOUTPUT;
+	int recordSize = RECORDBYTES;
+	int wantStats = 0;
+	int batchMode = 0;
+	int incremental = 0;
+	int numThreads = 0;					// 0 = number of cores
+	char **sources = NULL;				// files of --batch, @lists expanded
+	int numSources = 0, maxSources = 0;
+	int i, status;
+	double isaSeconds;
+	struct tickClock clock;				// ticks of phases => seconds, for --stats
+
+	/***********		Read options		************/
+	while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+		if (strcmp(argv[1], "--stats")==0)
+			wantStats = 1;
+		else if (strcmp(argv[1], "--batch")==0)
+			batchMode = 1;
+		else if (strcmp(argv[1], "-i")==0)
+			incremental = 1;
+		else if (strcmp(argv[1], "-o")==0 && argc > 2) {
+			outputName = argv[2];
+			argc--;
+			argv++;
+		}
+		else if (strcmp(argv[1], "-r")==0 && argc > 2) {
+			recordSize = atoi(argv[2]);
+			if (recordSize < 1 || recordSize > MAXRECORDBYTES) {
+				printf("Record size must be from 1 to %d bytes.\n", MAXRECORDBYTES);
+				return 0;
+			}
+			argc--;
+			argv++;
+		}
+		else if (strcmp(argv[1], "-j")==0 && argc > 2) {
+			numThreads = atoi(argv[2]);
+			argc--;
+			argv++;
+		}
+		else {
+			printf("Unknown option %s.\n" HELP, argv[1]);
+			return 0;
+		}
+		argc--;							// shift options away, so files are always argv[1] and argv[2]
+		argv++;
+	}
+	if (argc < 3) {
+		printf(HELP);
 		return 0;
 	}
 
 	/************		load instruction Set		**************/
-	fscanf(filePtr, "%d", &numInstructions);				// first element in file is number of instructions contained
-	struct instruction instructionSet[numInstructions];
-	finalProgramWord = (short *)malloc(1*sizeof(short));	// allocate space for one 14-bit instruction
-	// (it wil be updated basing on how many words are needed for the full program)
+	startClock(&clock);
+	isaSeconds = wallTime();
+	status = loadInstructionSet(argv[1], &instructionSet, 0);	// argv[1] will be the instruction set
+	isaSeconds = wallTime() - isaSeconds;
+	if (status == 1) {
+		printf("Invalid file.\n" HELP);
+		return 0;
+	}
+	else if (status != 0) {
+		printf("Not enough memory to load the instruction set.\n");
+		return 17;
+	}
 
-	for (i=0; i<numInstructions; i++) {
-		acquireInstruction(filePtr, &instructionSet[i]);	// call acquireInstruction to load the instruction in my struct.
-	}	// (instructionSet address is passed so I can modify it)
 
+	/************		batch mode: many files, many threads		***************/
+	if (batchMode) {
+		for (i=2; i<argc; i++) {
+			if (argv[i][0] == '@')				// @list: file names are read from list
+				status = readFileList(argv[i]+1, &sources, &numSources, &maxSources);
+			else
+				status = addSource(argv[i], &sources, &numSources, &maxSources);
+			if (status == 1) {
+				printf("Can't read file list %s.\n", argv[i]+1);
+				return 0;
+			}
+			else if (status == 17) {
+				printf("Not enough memory.\n");
+				return 17;
+			}
+		}
+		if (numThreads <= 0)
+			numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+		status = runBatch(&instructionSet, sources, numSources, numThreads, recordSize, incremental, wantStats, &result);
+		if (wantStats && status != 17)		// totals of all files
+			printStats(stdout, &instructionSet, &result, isaSeconds, &clock);
+		for (i=0; i<numSources; i++)
+			free(sources[i]);
+		free(sources);
+		freeInstructionSet(&instructionSet);
+		return status;
+	}
 
-	/***********		close instruction set file, open file to convert into HEX		***************/
-	fclose(filePtr);
-	if ((filePtr=fopen(argv[2], "r"))==NULL) {				// argv[2] will be instrToHex.asm
+
+	/************		assemble one file		***************/
+	if (incremental)
+		status = assembleIncremental(&instructionSet, argv[2], outputName, recordSize, &result, wantStats);
+	else
+		status = assembleFile(&instructionSet, argv[2], outputName, recordSize, &result, NULL, wantStats);	// argv[2] will be instrToHex.asm
+	if (status == 16) {
 		printf("Invalid file.\n" HELP);
 		return 0;
-    }
+	}
+	else if (status == 17)
+		printf("Not enough memory.\n");
+	else if (status == 18)
+		printf("Can't create destination file.\n");
+	else if (status == 19)
+		printf("%d errors found, %s not created.\n", result.numErrors, outputName);
+	else if (wantStats)						// standard output is only the JSON of stats (standard error if the hex file is there)
+		printStats((strcmp(outputName, "-") == 0) ? stderr : stdout, &instructionSet, &result, isaSeconds, &clock);
+	else if (result.patched)
+		printf("File %s updated: %lu lines changed, %lu words patched.\n", outputName, result.numChangedLines, result.numPatchedWords);
+	else if (strcmp(outputName, "-") != 0)
+		printf("File %s created.\n", outputName);
+	freeInstructionSet(&instructionSet);
+	return status;
+}
 
 
-	/************		read each line of file		***************/
-	while (fscanf(filePtr, "%s", acquiredOpName) != EOF) {
-		operands[0]=0;
-		operands[1]=0;
-		index = -1;							// index = -1 stands for instruction not valid.
+// FUNCTIONS DEFINITION
+int assembleFile(const struct instructionSet *set, const char *sourceName, const char *outputName, int recordSize, struct assembleResult *result,
+		struct lineMap *lines, int timePhases) {
+	// assembles sourceName into outputName with assembleSource; many files can be assembled at the same time
+	// lines, if not NULL, receives words and labels of each line for the cache of incremental mode
+	// timePhases 1 fills result->phases for --stats
+	struct sourceText source;
+	struct hexWriter *hexFile;
+	int fd = 1;
+	double start = wallTime();
+	unsigned long long loadTicks = readTicks();
 
-		for (i=0; i<numInstructions; i++) {	// search in array of struct instructionSet the data associated to instruction name acquired
-			if ( strcmp(acquiredOpName, instructionSet[i].name)==0 ) {
-				#ifdef DEBUG
-					printf("Acquired op is: %s\n", instructionSet[i].name);
-				#endif
+	memset(result, 0, sizeof(struct assembleResult));
 
-				index = i;					// instruction found in instructionSet at position "i"
-				break;
+	/***********		load file to convert into HEX		***************/
+	if (loadSource(sourceName, &source) != 0) {
+		result->status = 16;
+		return 16;
+	}
+	loadTicks = readTicks() - loadTicks;
+	if ((hexFile = (struct hexWriter *)malloc(sizeof(struct hexWriter))) == NULL) {
+		freeSource(&source);
+		result->status = 17;
+		return 17;
+	}
+
+
+	/*******		Open file in which the program will be written in hex format		*********/
+	if (strcmp(outputName, "-") != 0 && (fd = open(outputName, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		free(hexFile);
+		freeSource(&source);
+		result->status = 18;
+		return 18;
+	}
+	openHexWriter(hexFile, fd, recordSize);
+
+
+	/************		assemble, words are streamed to the file		***************/
+	assembleSource(set, source.data, source.size, sourceName, stderr, hexFile, lines ? &lines->words : NULL, lines, result, timePhases);
+	if (timePhases) {					// assembleSource cleared result, the read is added now
+		result->phases.ticks[PHASEREAD] += loadTicks;
+		result->phases.samples[PHASEREAD]++;
+		result->phases.events[PHASEREAD]++;
+	}
+	freeSource(&source);				// release instrToHex.asm
+	if (closeHexWriter(hexFile) != 0 && result->status == 0)	// last record, end of file record and last write
+		result->status = 18;
+	if (fd != 1 && close(fd) != 0 && result->status == 0)
+		result->status = 18;
+	if (result->status != 0 && fd != 1)
+		unlink(outputName);				// don't leave a partial program around
+
+	result->numRecords = hexFile->numRecords;
+	result->seconds = wallTime() - start;
+	free(hexFile);
+	return result->status;
+}
+
+void printStats(FILE *filePtr, const struct instructionSet *set, const struct assembleResult *result, double isaSeconds, struct tickClock *clock) {
+	// prints the JSON object of --stats: time of each phase and counters
+	static const char* const phaseName[NUMASMPHASES] = {"read", "tokenize", "lookup", "encode", "fixups", "emit", "record", "write"};
+	struct phaseTimer phases = result->phases;
+	double rate = tickRate(clock);
+	double nested = phaseSeconds(&phases, PHASERECORD, rate) + phaseSeconds(&phases, PHASEWRITE, rate);
+
+	// emit includes record and write, which run inside it: leave it only its own time, in ticks of one event each
+	if (phases.events[PHASEEMIT] > 0) {
+		phases.ticks[PHASEEMIT] -= (nested*rate < phases.ticks[PHASEEMIT]) ? nested*rate : phases.ticks[PHASEEMIT];
+		phases.samples[PHASEEMIT] = phases.events[PHASEEMIT];
+	}
+	fprintf(filePtr, "{\n  \"tool\": \"assembler\",\n  \"isaLoadSeconds\": %.6f,\n  \"seconds\": %.6f,\n", isaSeconds, result->seconds);
+	printPhases(filePtr, phaseName, NUMASMPHASES, &phases, rate);
+	fprintf(filePtr, ",\n  \"counters\": {\"lookups\": %lu, \"misses\": %lu, \"probes\": %lu, \"opcodeSlots\": %d, \"instructions\": %d,\n",
+			result->stats.lookups, result->stats.misses, result->stats.probes, set->opTable.size, set->numInstructions);
+	fprintf(filePtr, "    \"words\": %lu, \"records\": %lu, \"bufferCapacity\": %lu, \"allocations\": %lu, \"labels\": %lu, \"fixups\": %lu,\n",
+			result->numWords, result->numRecords, (unsigned long)result->bufferCapacity, result->numAllocations, result->numLabels, result->numFixups);
+	fprintf(filePtr, "    \"patched\": %d, \"changedLines\": %lu, \"patchedWords\": %lu}\n}\n",
+			result->patched, result->numChangedLines, result->numPatchedWords);
+}
+
+
+int assembleIncremental(const struct instructionSet *set, const char *sourceName, const char *outputName, int recordSize, struct assembleResult *result,
+		int timePhases) {
+	// patches outputName if only some lines of sourceName changed since the cache was written, otherwise assembles it all
+	struct sourceText source;
+	struct lineMap lines;
+	unsigned int *lineHash;
+	char *cacheName;
+	int numLines, status;
+	double start = wallTime();
+
+	if (strcmp(outputName, "-") == 0 || strcmp(sourceName, "-") == 0)	// nothing to patch, or nothing to compare later
+		return assembleFile(set, sourceName, outputName, recordSize, result, NULL, timePhases);
+	if (loadSource(sourceName, &source) != 0) {
+		memset(result, 0, sizeof(struct assembleResult));
+		result->status = 16;
+		return 16;
+	}
+	cacheName = (char *)malloc(strlen(outputName) + strlen(CACHESUFFIX) + 1);
+	if (cacheName == NULL || (lineHash = hashLines(&source, &numLines)) == NULL) {
+		free(cacheName);
+		freeSource(&source);
+		memset(result, 0, sizeof(struct assembleResult));
+		result->status = 17;
+		return 17;
+	}
+	strcpy(cacheName, outputName);
+	strcat(cacheName, CACHESUFFIX);
+
+	if (patchOutput(set, &source, sourceName, lineHash, numLines, outputName, cacheName, recordSize, result) == 0) {
+		result->seconds = wallTime() - start;
+		status = 0;
+	}
+	else {									// cache missing or not usable: assemble everything and write the cache again
+		memset(&lines, 0, sizeof(lines));
+		status = assembleFile(set, sourceName, outputName, recordSize, result, &lines, timePhases);
+		if (status != 0 || writeCache(cacheName, outputName, set, recordSize, lineHash, numLines, &lines) != 0)
+			unlink(cacheName);				// a stale cache would be rejected anyway, but don't leave it around
+		free(lines.line);
+		free(lines.words.word);
+		free(lines.symbolData);
+		free(lines.run);
+	}
+	free(lineHash);
+	free(cacheName);
+	freeSource(&source);
+	return status;
+}
+
+
+int patchOutput(const struct instructionSet *set, const struct sourceText *source, const char *sourceName, const unsigned int *lineHash,
+		int numLines, const char *outputName, const char *cacheName, int recordSize, struct assembleResult *result) {
+	// returns 0 if outputName and its cache were patched, 1 if the file must be assembled from scratch
+	struct cacheHeader header;
+	struct lineEntry *cacheLine = NULL;
+	unsigned short *cacheWord = NULL;
+	char *symbolData = NULL;
+	struct cacheRun *runs = NULL;
+	struct symbolTable symbols = {0, NULL, NULL, 0, 0};
+	struct fixupList fixups = {NULL, 0, 0};
+	struct wordPatch *patch = NULL;
+	size_t numPatches = 0, maxPatches = 0;
+	int *changed = NULL;				// lines that changed
+	int numChanged = 0, maxChanged = 0;
+	struct lexer lex;
+	struct token tok;
+	struct stat info;
+	const char *p, *lineEnd;
+	unsigned long address = 0;
+	unsigned short word;
+	unsigned int value, length;
+	unsigned long orgAddress;
+	unsigned char record[5 + MAXRECORDBYTES];	// bytes of the record being patched
+	off_t offset, recordStart = -1;
+	int i, j, line, index, numWords, pos, numBytes = 0;
+	int fd = -1, status = 1;
+
+	memset(result, 0, sizeof(struct assembleResult));
+	if ((fd = open(cacheName, O_RDWR)) < 0)
+		return 1;
+	if (read(fd, &header, sizeof(header)) != sizeof(header) || memcmp(header.magic, CACHEMAGIC, 8) != 0
+			|| header.version != CACHEVERSION || header.recordSize != (unsigned int)recordSize || header.numLines != (unsigned int)numLines
+			|| header.isaHash != hashName((const char *)set->instr, set->numInstructions*sizeof(struct instruction))
+			|| stat(outputName, &info) != 0 || info.st_size != header.outputSize
+			|| info.st_mtim.tv_sec != header.outputSec || info.st_mtim.tv_nsec != header.outputNsec)
+		goto done;
+	cacheLine = (struct lineEntry *)malloc(numLines*sizeof(struct lineEntry) + 1);
+	cacheWord = (unsigned short *)malloc(header.numWords*sizeof(unsigned short) + 1);
+	symbolData = (char *)malloc(header.symbolDataSize + 1);
+	runs = (struct cacheRun *)malloc(header.numRuns*sizeof(struct cacheRun) + 1);
+	if (cacheLine == NULL || cacheWord == NULL || symbolData == NULL || runs == NULL
+			|| read(fd, cacheLine, numLines*sizeof(struct lineEntry)) != (ssize_t)(numLines*sizeof(struct lineEntry))
+			|| read(fd, cacheWord, header.numWords*sizeof(unsigned short)) != (ssize_t)(header.numWords*sizeof(unsigned short))
+			|| read(fd, symbolData, header.symbolDataSize) != (ssize_t)header.symbolDataSize
+			|| read(fd, runs, header.numRuns*sizeof(struct cacheRun)) != (ssize_t)(header.numRuns*sizeof(struct cacheRun)))
+		goto done;
+
+	for (i=0, pos=0; i<(int)header.numSymbols; i++) {	// labels of the cache, their names point in symbolData
+		if (pos + 8 > (int)header.symbolDataSize)
+			goto done;
+		memcpy(&value, symbolData + pos, 4);
+		memcpy(&length, symbolData + pos + 4, 4);
+		if (pos + 8 + length > header.symbolDataSize || (index = findSymbol(&symbols, symbolData + pos + 8, length)) < 0)
+			goto done;
+		symbols.symbol[index].value = value;
+		symbols.symbol[index].line = 1;
+		pos += 8 + length;
+	}
+
+
+	/************		assemble again the lines that changed		***************/
+	for (line=0, p=source->data; line<numLines; line++, p=lineEnd+1) {
+		lineEnd = memchr(p, '\n', source->data + source->size - p);
+		if (lineEnd == NULL)
+			lineEnd = source->data + source->size;
+		if (lineHash[line] == cacheLine[line].hash) {
+			address += cacheLine[line].numWords;
+			if (cacheLine[line].flags & LINEADDRESS) {	// org (or __config): the address of the next words is read again
+				initLexer(&lex, p, lineEnd - p, sourceName, NULL);
+				while (nextToken(&lex, &tok))
+					if (findDirective(&tok) == DIRORG && parseDirective(&lex, DIRORG, 1, &orgAddress) == 0)
+						address = orgAddress;
 			}
+			continue;
 		}
+		if (cacheLine[line].flags & (LINELABEL | LINEADDRESS))	// labels may move, words placed elsewhere may change
+			goto done;
 
-		if (index != -1) {					// if index is not -1 (so it means that i found a correct instruction)
-		// the code below extracts all operands from file and puts them into array operands[], erasing characters like ',' ' ' and '0x'
-			fscanf(filePtr, "%c", &c);      // eliminate ' ' after name. Example: movwl' '.4
-			for (j=0; j<instructionSet[index].numOperands; j++) {		// acquire data from operands followed by ','
-				fscanf(filePtr, "%c", &c);						// acquire . or 0 (decimal or hex)
-				if (c == '.') {									// if the character is '.', the following is a decimal number
-					fscanf(filePtr, "%d", &operands[j]);		// get OPERAND as decimal number
-					if (j<instructionSet[index].numOperands-1)	// if it's not the last operand (so it is followed by ',')
-						fscanf(filePtr, "%c", &c);				// remove ','
-				}
-				else if (c == '0') {							// if the character is '0', the following is a hex number
-					fscanf(filePtr, "%c", &c);					// remove 'x' (0x now removed)
-					fscanf(filePtr, "%x", &operands[j]);		// get OPERAND as hex number
-					if (j<instructionSet[index].numOperands-1)	// if it's not the last operand (so it is followed by ',')
-						fscanf(filePtr, "%c", &c);				// remove ','
+		initLexer(&lex, p, lineEnd - p, sourceName, stderr);
+		lex.line = line+1;
+		numWords = 0;
+		while (nextToken(&lex, &tok)) {
+			if (tok.start[tok.length-1] == ':')
+				goto done;
+			index = findInstruction(&set->opTable, set->instr, tok.start, tok.length, &result->stats);
+			if (index == -1) {
+				if (findDirective(&tok) != DIRNONE)
+					goto done;					// words of directives are placed by a full assembly
+				if (tok.column == 1 && identifierLength(tok.start, tok.start + tok.length) == tok.length)
+					goto done;					// new label
+				continue;
+			}
+			if (numWords == cacheLine[line].numWords)
+				goto done;						// more words than before: addresses after them change
+			if ((j = findRun(runs, header.numRuns, address + numWords)) < 0
+					|| runs[j].index + (address + numWords - runs[j].address) >= header.numWords)
+				goto done;						// not a word of the hex file: the cache is not what it should be
+			if (encodeInstruction(&set->instr[index], &lex, &symbols, &fixups, address + numWords, &word) != 0 || fixups.count > 0)
+				goto done;						// errors and new labels are reported by a full assembly
+			if (word != cacheWord[runs[j].index + (address + numWords - runs[j].address)]) {
+				if (numPatches == maxPatches) {
+					maxPatches = (maxPatches == 0) ? 64 : 2*maxPatches;
+					if ((patch = (struct wordPatch *)realloc(patch, maxPatches*sizeof(struct wordPatch))) == NULL)
+						goto done;
 				}
+				patch[numPatches].address = address + numWords;
+				patch[numPatches].index = runs[j].index + (address + numWords - runs[j].address);
+				patch[numPatches].run = j;
+				patch[numPatches++].word = word;
 			}
+			numWords++;
+		}
+		if (numWords != cacheLine[line].numWords)
+			goto done;
+		if (numChanged == maxChanged) {
+			maxChanged = (maxChanged == 0) ? 64 : 2*maxChanged;
+			if ((changed = (int *)realloc(changed, maxChanged*sizeof(int))) == NULL)
+				goto done;
+		}
+		changed[numChanged++] = line;
+		address += numWords;
+	}
 
-			hexInstruction = ( instructionSet[index].opCode << instructionSet[index].shiftOpCode );	// puts opCode in hexInstruction
-			for(j=0; j<instructionSet[index].numOperands; j++) {// puts operands in hexInstruction
-				hexInstruction += ( operands[j] << instructionSet[index].shiftOperand[j] );
+
+	/************		write new words over old ones, one record at a time		***************/
+	if (numPatches > 0) {
+		close(fd);
+		if ((fd = open(outputName, O_RDWR)) < 0)
+			goto done;
+		for (i=0; i<2*(int)numPatches; i++) {			// low byte, then high byte of each word
+			offset = recordOffset(2*patch[i/2].address + (i&1), &runs[patch[i/2].run], recordSize, &pos);
+			if (offset != recordStart) {
+				if (recordStart >= 0 && patchRecord(fd, recordStart, record, numBytes) != 0)
+					goto done;
+				if ((numBytes = patchRecord(fd, offset, record, 0)) < 0 || record[3] != 0 || pos >= record[0]
+						|| ((record[1]<<8) | record[2]) != ((2*patch[i/2].address + (i&1) - pos) & 0xffff))
+					goto done;					// not the record expected: the hex file is not what the cache says
+				recordStart = offset;
 			}
+			record[4 + pos] = (i&1) ? patch[i/2].word >> 8 : patch[i/2].word & 0xff;
+		}
+		if (patchRecord(fd, recordStart, record, numBytes) != 0 || fstat(fd, &info) != 0 || close(fd) != 0) {
+			fd = -1;
+			goto done;
+		}
+		if ((fd = open(cacheName, O_RDWR)) < 0)
+			goto done;
+	}
 
-			#ifdef DEBUG
-				printf("INSTRUCTION IS: %04x\n\n", hexInstruction);
-			#endif
-			
-				// reallocate space to contain one more instruction
-			finalProgramWord = (short*)realloc( finalProgramWord, (numWords+1)*sizeof(short) );
-			swapData(&hexInstruction);	// after this function call the hexInstruction will be swapped like: 3003 => 0330 or 1234 => 3412
-			finalProgramWord[numWords] = hexInstruction;		// load new hexInstruction swapped
-			checksum += (hexInstruction)&(0xff);				// adding first 8 bits to checksum
-			#ifdef DEBUG
-				printf("Checksum1: %x\n", checksum);
-			#endif
-			checksum += (hexInstruction>>8)&(0xff);				// adding second 8 bits to checksum
-			#ifdef DEBUG
-				printf("Checksum2: %x\n", checksum);
-			#endif
-			numWords++;
+	for (i=0; i<numChanged; i++) {				// update the cache in place
+		cacheLine[changed[i]].hash = lineHash[changed[i]];
+		if (pwrite(fd, &cacheLine[changed[i]], sizeof(struct lineEntry), sizeof(header) + changed[i]*sizeof(struct lineEntry)) != sizeof(struct lineEntry))
+			goto done;
+	}
+	for (i=0; i<(int)numPatches; i++)
+		if (pwrite(fd, &patch[i].word, sizeof(unsigned short), sizeof(header) + numLines*sizeof(struct lineEntry)
+				+ patch[i].index*sizeof(unsigned short)) != sizeof(unsigned short))
+			goto done;
+	header.outputSize = info.st_size;
+	header.outputSec = info.st_mtim.tv_sec;
+	header.outputNsec = info.st_mtim.tv_nsec;
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+		goto done;
+
+	result->patched = 1;
+	result->numWords = header.numWords;
+	result->numChangedLines = numChanged;
+	result->numPatchedWords = numPatches;
+	status = 0;
+
+done:
+	if (fd >= 0)
+		close(fd);
+	freeSymbols(&symbols, &fixups);
+	free(cacheLine);
+	free(cacheWord);
+	free(symbolData);
+	free(runs);
+	free(patch);
+	free(changed);
+	return status;
+}
+
+
+int writeCache(const char *cacheName, const char *outputName, const struct instructionSet *set, int recordSize,
+		const unsigned int *lineHash, int numLines, struct lineMap *lines) {
+	struct cacheHeader header;
+	struct cacheRun *runs;
+	struct stat info;
+	FILE *filePtr;
+	off_t offset = EXTRECORDTEXT;				// the hex file starts with the extended address record of 0
+	unsigned long start, upper = 0, index = 0;
+	int i, error;
+
+	if (stat(outputName, &info) != 0 || (numLines > 0 && markLine(lines, numLines, 0, 0) != 0))	// lines without words are in the map too
+		return 1;
+	for (i=0; i<numLines; i++)
+		lines->line[i].hash = lineHash[i];
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHEMAGIC, 8);
+	header.version = CACHEVERSION;
+	header.isaHash = hashName((const char *)set->instr, set->numInstructions*sizeof(struct instruction));
+	header.recordSize = recordSize;
+	header.numLines = numLines;
+	header.numWords = lines->words.count;
+	header.numSymbols = lines->numSymbols;
+	header.symbolDataSize = lines->symbolDataSize;
+	header.outputSize = info.st_size;
+	header.outputSec = info.st_mtim.tv_sec;
+	header.outputNsec = info.st_mtim.tv_nsec;
+
+	header.numRuns = lines->numRuns;
+	if ((runs = (struct cacheRun *)malloc(lines->numRuns*sizeof(struct cacheRun) + 1)) == NULL)
+		return 1;
+	for (i=0; i<lines->numRuns; i++) {			// where hexWriter put the records of each run
+		start = 2*lines->run[i].address;
+		if ((start >> 16) != upper)				// extended address record before the first record
+			offset += EXTRECORDTEXT;
+		runs[i].address = lines->run[i].address;
+		runs[i].numWords = lines->run[i].numWords;
+		runs[i].index = index;
+		runs[i].offset = offset;
+		index += lines->run[i].numWords;
+		offset += runText(start, start + 2*lines->run[i].numWords, recordSize);
+		upper = (start + 2*lines->run[i].numWords - 1) >> 16;
+	}
+	if (offset + 12 != info.st_size || (filePtr = fopen(cacheName, "wb")) == NULL) {	// 12: end of file record
+		free(runs);
+		return 1;
+	}
+	error = fwrite(&header, sizeof(header), 1, filePtr) != 1
+			|| fwrite(lines->line, sizeof(struct lineEntry), numLines, filePtr) != (size_t)numLines
+			|| fwrite(lines->words.word, sizeof(unsigned short), lines->words.count, filePtr) != lines->words.count
+			|| fwrite(lines->symbolData, 1, lines->symbolDataSize, filePtr) != lines->symbolDataSize
+			|| fwrite(runs, sizeof(struct cacheRun), lines->numRuns, filePtr) != (size_t)lines->numRuns;
+	free(runs);
+	if (fclose(filePtr) != 0)
+		error = 1;
+	return error;
+}
+
+
+unsigned int *hashLines(const struct sourceText *source, int *numLines) {	// hash of each line of source, NULL if there is no memory
+	const char *p = source->data, *end = source->data + source->size, *lineEnd;
+	unsigned int *hash = NULL, *bigger;
+	int capacity = 0;
+
+	*numLines = 0;
+	while (p < end) {
+		if ((lineEnd = memchr(p, '\n', end - p)) == NULL)
+			lineEnd = end;						// last line without '\n'
+		if (*numLines == capacity) {
+			capacity = (capacity == 0) ? 1024 : 2*capacity;
+			if ((bigger = (unsigned int *)realloc(hash, capacity*sizeof(unsigned int))) == NULL) {
+				free(hash);
+				return NULL;
+			}
+			hash = bigger;
 		}
+		hash[(*numLines)++] = hashName(p, lineEnd - p);
+		p = lineEnd + 1;
 	}
-	checksum += numWords*2;				// adding data field to checksum (in this implementation address is always 0x0 so it won't be added)
-	#ifdef DEBUG
-		printf("checksum: %x\n", checksum);
-	#endif
-	checksum = ~checksum;				// negate checksum 	(first step to get the final value)
-	checksum += 1;						// add 1		(second step to get checksum -- "not" and "+1" are needed to get 2s complement)
-	checksum = checksum & 0xff;			// extract a byte	(last step to get checksum, we take only first byte)
-	#ifdef DEBUG
-		printf("Final value of checksum: %02x\n", checksum);
-	#endif
+	return (hash != NULL) ? hash : (unsigned int *)malloc(sizeof(unsigned int));	// empty file: still not NULL
+}
 
-	fclose(filePtr);					// close instrToHex.asm
 
+int runBatch(const struct instructionSet *set, char **sources, int numSources, int numWorkers, int recordSize, int incremental,
+		int timePhases, struct assembleResult *total) {
+	// assembles all sources, prints a line per file and puts in total the sum of their results
+	struct batch batch;
+	struct worker *workers;
+	pthread_t *threads;
+	int i, status = 17, numFailed = 0;
+	double start = wallTime();
 
-	/*******		Write program in hex format in a file		*********/
-	if((filePtr=fopen("hexFormatProgram.txt", "w"))==NULL)	{
-			printf("Can't create destination file.\n");
-			return 18;
+	if (numWorkers > numSources)
+		numWorkers = (numSources > 0) ? numSources : 1;
+	batch.set = set;
+	batch.sources = sources;
+	batch.recordSize = recordSize;
+	batch.incremental = incremental;
+	batch.timePhases = timePhases;
+	batch.numWorkers = numWorkers;
+	batch.outputs = (char **)calloc(numSources + 1, sizeof(char *));	// zeros: names not made yet are freed as NULL
+	batch.results = (struct assembleResult *)calloc(numSources + 1, sizeof(struct assembleResult));
+	batch.queue = (struct jobQueue *)malloc(numWorkers*sizeof(struct jobQueue));
+	workers = (struct worker *)malloc(numWorkers*sizeof(struct worker));
+	threads = (pthread_t *)malloc(numWorkers*sizeof(pthread_t));
+	if (batch.outputs == NULL || batch.results == NULL || batch.queue == NULL || workers == NULL || threads == NULL) {
+		printf("Not enough memory.\n");
+		goto done;
 	}
+	for (i=0; i<numSources; i++)
+		if ((batch.outputs[i] = hexNameFor(sources[i])) == NULL) {
+			printf("Not enough memory.\n");
+			goto done;
+		}
+
+	for (i=0; i<numWorkers; i++) {			// each thread starts with a contiguous share of the files
+		pthread_mutex_init(&batch.queue[i].lock, NULL);
+		batch.queue[i].head = (long)numSources*i/numWorkers;
+		batch.queue[i].tail = (long)numSources*(i+1)/numWorkers;
+		workers[i].batch = &batch;
+		workers[i].id = i;
+	}
+	for (i=1; i<numWorkers; i++)
+		pthread_create(&threads[i], NULL, batchWorker, &workers[i]);
+	batchWorker(&workers[0]);				// main thread is worker 0
+	for (i=1; i<numWorkers; i++)
+		pthread_join(threads[i], NULL);
 
-	fprintf(filePtr, ":020000040000fa\n");		// print on file extended linear address
-	fprintf(filePtr, ":%02x", numWords*2);		// print on file number of bytes of data field (each instr word is made of 2 bytes)
-	fprintf(filePtr, "000000");					// print on file program memory start address "0000" and data type "00"
 
-	for (i=0; i<numWords; i++)	{
-		fprintf(filePtr, "%04x", finalProgramWord[i]);	// print on file data field
+	/************		report, in the same order of the files		***************/
+	memset(total, 0, sizeof(struct assembleResult));
+	for (i=0; i<numSources; i++) {
+		switch (batch.results[i].status) {
+			case 0:
+				if (batch.results[i].patched)
+					printf("%s -> %s: %lu lines changed, %lu words patched, %.3f ms\n", sources[i], batch.outputs[i],
+							batch.results[i].numChangedLines, batch.results[i].numPatchedWords, 1000*batch.results[i].seconds);
+				else
+					printf("%s -> %s: %lu words, %.3f ms\n", sources[i], batch.outputs[i], batch.results[i].numWords, 1000*batch.results[i].seconds);
+				break;
+			case 16:
+				printf("%s: can't be read\n", sources[i]);
+				break;
+			case 17:
+				printf("%s: not enough memory\n", sources[i]);
+				break;
+			case 18:
+				printf("%s: can't write %s\n", sources[i], batch.outputs[i]);
+				break;
+			default:
+				printf("%s: %d errors, %s not created\n", sources[i], batch.results[i].numErrors, batch.outputs[i]);
+				break;
+		}
+		if (batch.results[i].status != 0)
+			numFailed++;
+		total->stats.lookups += batch.results[i].stats.lookups;
+		total->stats.misses += batch.results[i].stats.misses;
+		total->stats.probes += batch.results[i].stats.probes;
+		total->numWords += batch.results[i].numWords;
+		total->numRecords += batch.results[i].numRecords;
+		total->numAllocations += batch.results[i].numAllocations;
+		if (batch.results[i].bufferCapacity > total->bufferCapacity)
+			total->bufferCapacity = batch.results[i].bufferCapacity;
+		total->numLabels += batch.results[i].numLabels;
+		total->numFixups += batch.results[i].numFixups;
+		total->numChangedLines += batch.results[i].numChangedLines;
+		total->numPatchedWords += batch.results[i].numPatchedWords;
+		total->seconds += batch.results[i].seconds;	// time of all threads
+		addPhases(&total->phases, &batch.results[i].phases);
+	}
+	printf("%d files assembled, %d failed, %d threads, %.3f s\n", numSources-numFailed, numFailed, numWorkers, wallTime()-start);
+
+	for (i=0; i<numWorkers; i++)
+		pthread_mutex_destroy(&batch.queue[i].lock);
+	status = (numFailed > 0) ? 19 : 0;
+
+done:
+	for (i=0; batch.outputs != NULL && i<numSources; i++)
+		free(batch.outputs[i]);
+	free(batch.outputs);
+	free(batch.results);
+	free(batch.queue);
+	free(workers);
+	free(threads);
+	return status;
+}
+
+
+void *batchWorker(void *arg) {
+	struct worker *self = (struct worker *)arg;
+	struct batch *batch = self->batch;
+	int job;
+
+	while ((job = takeJob(batch, self->id)) >= 0)
+		if (batch->incremental)
+			assembleIncremental(batch->set, batch->sources[job], batch->outputs[job], batch->recordSize, &batch->results[job], batch->timePhases);
+		else
+			assembleFile(batch->set, batch->sources[job], batch->outputs[job], batch->recordSize, &batch->results[job], NULL, batch->timePhases);
+	return NULL;
+}
+
+
+int takeJob(struct batch *batch, int id) {		// returns next file for thread id, or -1 when there are no files left at all
+	struct jobQueue *own = &batch->queue[id];
+	struct jobQueue *victim;
+	int i, job = -1, best, left, stolen;
+
+	pthread_mutex_lock(&own->lock);
+	if (own->head < own->tail)
+		job = own->head++;
+	pthread_mutex_unlock(&own->lock);
+
+	while (job < 0) {							// own queue is empty: steal from the longest queue
+		best = -1;
+		left = 0;
+		for (i=0; i<batch->numWorkers; i++) {	// lengths may change before victim is locked, they are only a hint
+			if (i == id)
+				continue;
+			pthread_mutex_lock(&batch->queue[i].lock);
+			if (batch->queue[i].tail - batch->queue[i].head > left) {
+				left = batch->queue[i].tail - batch->queue[i].head;
+				best = i;
+			}
+			pthread_mutex_unlock(&batch->queue[i].lock);
+		}
+		if (best < 0)
+			return -1;							// nothing left anywhere
+
+		victim = &batch->queue[best];
+		pthread_mutex_lock(&victim->lock);
+		left = victim->tail - victim->head;
+		stolen = 0;
+		if (left > 0) {
+			stolen = (left+1)/2;				// take the last half of victim's files
+			victim->tail -= stolen;
+			job = victim->tail;
+		}
+		pthread_mutex_unlock(&victim->lock);
+		if (stolen > 1) {						// own lock is never taken while holding another one, so no deadlock
+			pthread_mutex_lock(&own->lock);
+			own->head = job + 1;
+			own->tail = job + stolen;
+			pthread_mutex_unlock(&own->lock);
+		}
 	}
+	return job;
+}
+
 
-	fprintf(filePtr, "%02x\n", checksum);		// print on file checksum
-	fprintf(filePtr, ":00000001ff\n");			// end of file string.
-	printf("File hexFormatProgram.txt created.\n");
+int readFileList(const char *listName, char ***sources, int *numSources, int *maxSources) {
+	// adds to sources the names listed in listName, one per line; empty lines and lines starting with ';' or '#' are skipped
+	// returns 0, 1 if listName can't be read, 17 if there is no memory
+	FILE *filePtr;
+	char line[MAXPATH];
+	int length;
+
+	if ((filePtr=fopen(listName, "r"))==NULL)
+		return 1;
+	while (fgets(line, sizeof(line), filePtr) != NULL) {
+		length = strlen(line);
+		while (length > 0 && (line[length-1] == '\n' || line[length-1] == '\r' || line[length-1] == ' ' || line[length-1] == '\t'))
+			line[--length] = '\0';
+		if (length == 0 || line[0] == ';' || line[0] == '#')
+			continue;
+		if (addSource(line, sources, numSources, maxSources) != 0) {
+			fclose(filePtr);
+			return 17;
+		}
+	}
 	fclose(filePtr);
 	return 0;
 }
 
 
-// FUNCTIONS DEFINITION
-int acquireInstruction(FILE* filePtr, struct instruction *instructionToSet)	{	// -> will be used instead of . to dereference the pointer and access it
-	fscanf(filePtr, "%d", &instructionToSet->numOperands);			// first parameter in file is number of operands
-	fscanf(filePtr, "%s", instructionToSet->name);					// second parameter in file is name of instruction
-	for (int i=0; i< instructionToSet->numOperands; i++) {
-		fscanf(filePtr, "%d", &instructionToSet->maskOperand[i]);	// next parameters are masks and shifts relative to operands
-        fscanf(filePtr, "%d", &instructionToSet->shiftOperand[i]);
-	}
-    fscanf(filePtr, "%d", &instructionToSet->opCode);				// next parameter is opcode
-	fscanf(filePtr, "%d", &instructionToSet->shiftOpCode);			// last parameter is shift of opCode
+int addSource(const char *name, char ***sources, int *numSources, int *maxSources) {
+	// appends a copy of name to sources, growing it when full; returns 0, 17 if there is no memory
+	char **bigger, *copy;
+	int capacity;
+
+	if (*numSources == *maxSources) {
+		capacity = (*maxSources == 0) ? 64 : 2*(*maxSources);
+		if ((bigger = (char **)realloc(*sources, capacity*sizeof(char *))) == NULL)
+			return 17;
+		*sources = bigger;
+		*maxSources = capacity;
+	}
+	if ((copy = strdup(name)) == NULL)
+		return 17;
+	(*sources)[(*numSources)++] = copy;
 	return 0;
 }
 
 
+char *hexNameFor(const char *sourceName) {		// file.asm => file.hex, other names get .hex appended; NULL if there is no memory
+	size_t length = strlen(sourceName);
+	char *hexName = (char *)malloc(length + 5);
+
+	if (hexName == NULL)
+		return NULL;
+	memcpy(hexName, sourceName, length + 1);
+	if (length > 4 && strcmp(sourceName + length - 4, ".asm") == 0)
+		length -= 4;
+	strcpy(hexName + length, ".hex");
+	return hexName;
+}
+
+
+double wallTime(void) {							// seconds from an arbitrary moment, used for timings
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec*1e-9;
+}
+
+
 int printInstruction(struct instruction instructionToSet) {
 	printf("%u ", instructionToSet.numOperands);                // first parameter in file is number of operands
     printf("%s ", instructionToSet.name);						// second parameter in file is name of instruction
@@ -222,14 +967,89 @@ int printInstruction(struct instruction instructionToSet) {
 }
 
 
-int swapData(short* hexToSwap) {
-	union instrWord swapper;						// swapper is a temp variable used to swap bytes (2 with 2)
-	char byteTemp;
+int findRun(const struct cacheRun *runs, int numRuns, unsigned long address) {
+	// run that contains the word at address (runs are in order of address), -1 if it is in none
+	int low = 0, high = numRuns, middle;
+
+	while (low < high) {						// first run after address
+		middle = (low + high) / 2;
+		if (runs[middle].address <= address)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	if (low == 0 || address - runs[low-1].address >= runs[low-1].numWords)
+		return -1;
+	return low - 1;
+}
+
+
+off_t recordOffset(unsigned long byteAddress, const struct cacheRun *run, int recordSize, int *pos) {
+	// position in the hex file of the record that contains byteAddress, a byte of run, as written by hexWriter;
+	// *pos is the byte in the record. Records of a run are full, except the last one before each 64K boundary
+	unsigned long start = 2*run->address;
+	off_t offset = run->offset;
+
+	if ((byteAddress >> 16) != (start >> 16)) {		// segments before the one of byteAddress, then its extended address record
+		offset += runText(start, byteAddress & ~0xffffUL, recordSize) + EXTRECORDTEXT;
+		start = byteAddress & ~0xffffUL;
+	}
+	*pos = (byteAddress - start)%recordSize;
+	return offset + ((byteAddress - start)/recordSize)*(12 + 2*recordSize);
+}
+
+
+off_t runText(unsigned long start, unsigned long end, int recordSize) {
+	// characters of the records of bytes start...end-1 of a run, with the extended address records inside it
+	off_t text = 0;
+	unsigned long segmentEnd, numBytes;
+
+	while (start < end) {
+		segmentEnd = (start | 0xffff) + 1;			// a record can't go across a 64K boundary
+		if (segmentEnd > end)
+			segmentEnd = end;
+		numBytes = segmentEnd - start;
+		text += (numBytes/recordSize)*(12 + 2*recordSize) + ((numBytes%recordSize) ? 12 + 2*(numBytes%recordSize) : 0);
+		if (segmentEnd < end)
+			text += EXTRECORDTEXT;
+		start = segmentEnd;
+	}
+	return text;
+}
+
+
+int patchRecord(int fd, off_t offset, unsigned char *bytes, int numBytes) {
+	// numBytes 0: reads the record at offset in bytes (length, address, type, data, checksum) and returns how many they are, -1 if not valid
+	// otherwise: computes the checksum of bytes and writes the record at offset; returns 0, or -1 if the write fails
+	static const char hexDigit[] = "0123456789abcdef";
+	char line[1 + 2*(5+MAXRECORDBYTES)];
+	unsigned int sum = 0;
+	int i, n, high, low;
+
+	if (numBytes == 0) {
+		if ((n = pread(fd, line, sizeof(line), offset)) < 11 || line[0] != ':')
+			return -1;
+		for (i=0; 1+2*i+1 < n; i++) {
+			high = (line[1+2*i] <= '9') ? line[1+2*i] - '0' : (line[1+2*i] | 0x20) - 'a' + 10;
+			low = (line[2+2*i] <= '9') ? line[2+2*i] - '0' : (line[2+2*i] | 0x20) - 'a' + 10;
+			if (high < 0 || high > 15 || low < 0 || low > 15)
+				return -1;
+			bytes[i] = (high<<4) | low;
+			if (i >= 4 && i == 4 + bytes[0])	// checksum read: record complete
+				return i+1;
+		}
+		return -1;
+	}
+
+	for (i=0; i<numBytes-1; i++)
+		sum += bytes[i];
+	bytes[numBytes-1] = (~sum + 1) & 0xff;		// checksum is 2s complement of the sum of all bytes
+	line[0] = ':';
+	for (i=0; i<numBytes; i++) {
+		line[1+2*i] = hexDigit[bytes[i]>>4];
+		line[2+2*i] = hexDigit[bytes[i]&0xf];
+	}
+	return (pwrite(fd, line, 1 + 2*numBytes, offset) == 1 + 2*numBytes) ? 0 : -1;
+}
+
 
-	swapper.fullWord = *hexToSwap;					// loading entire word in swapper
-	byteTemp = swapper.byteWord[1];					// swap first 2 bytes with other 2 bytes
-	swapper.byteWord[1] = swapper.byteWord[0];
-	swapper.byteWord[0] = byteTemp;
-	*hexToSwap = swapper.fullWord;
-	return 0;
-}
\ No newline at end of file
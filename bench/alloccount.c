@@ -0,0 +1,61 @@
+/*
+
+Allocation counter loaded with LD_PRELOAD by the benchmark harness.
+
+	Every call to malloc, calloc and realloc is counted (from all threads) together with the bytes requested.
+	At exit the counts are written as "calls bytes" in the file named by the environment variable ALLOCCOUNT_OUT,
+	or on standard error if it is not set.
+
+	Build with: gcc -O2 -shared -fPIC alloccount.c -o alloccount.so (or make bench from the main directory)
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t);		// glibc entry points: no dlsym, which allocates itself
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void*, size_t);
+
+static unsigned long numCalls;
+static unsigned long numBytes;
+
+
+void *malloc(size_t size) {
+	__atomic_add_fetch(&numCalls, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&numBytes, size, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+
+void *calloc(size_t count, size_t size) {
+	__atomic_add_fetch(&numCalls, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&numBytes, count*size, __ATOMIC_RELAXED);
+	return __libc_calloc(count, size);
+}
+
+
+void *realloc(void *block, size_t size) {
+	__atomic_add_fetch(&numCalls, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&numBytes, size, __ATOMIC_RELAXED);
+	return __libc_realloc(block, size);
+}
+
+
+__attribute__((destructor)) static void writeCounts(void) {
+	char text[64];
+	const char *fileName = getenv("ALLOCCOUNT_OUT");
+	int fd = 2, length;
+	ssize_t written;
+
+	length = snprintf(text, sizeof(text), "%lu %lu\n", numCalls, numBytes);
+	if (fileName != NULL && (fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return;
+	written = write(fd, text, length);	// if it fails nothing can be done, the program is exiting
+	(void)written;
+	if (fd != 2)
+		close(fd);
+}
@@ -0,0 +1,279 @@
+/*
+
+Benchmark harness of assembler and disassembler.
+
+	/// USAGE ///
+	bench [-n repeats] [-v version] [-a alloccount.so] assembler disassembler instructionSet source.asm image.hex
+	Each case is run repeats times (default 5), the fastest run is reported. Cases:
+	 assemble				source.asm is assembled.
+	 disassemble			image.hex is disassembled with 1 thread.
+	 disassembleParallel	image.hex is disassembled with the default number of threads.
+	 roundTrip				source.asm is assembled, the result disassembled and the text assembled again:
+							"identical" tells if the two hex files are the same.
+	Peak RSS is the largest of all runs (from wait4). Allocations are counted in one more run with alloccount.so
+	(default: alloccount.so next to this program) loaded with LD_PRELOAD; they are -1 if it can't be loaded.
+
+	/// OUTPUT ///
+	A JSON object on standard output: version (to compare results of different versions of the tools), repeats and
+	one element of results per case, with lines, bytes, seconds, linesPerSecond, megabytesPerSecond, peakRssKb,
+	allocations and allocatedBytes. Lines and bytes are those of the input of the case (for roundTrip, of source.asm).
+
+	Build with: gcc -O2 bench.c -o bench (or make bench from the main directory)
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define HELP "Usage: bench [-n repeats] [-v version] [-a alloccount.so] assembler disassembler instructionSet source.asm image.hex\n"
+#define MAXSTEPS 3			// commands of a case
+#define MAXARGS 8
+
+struct measure {				// what was measured for a case
+	double seconds;				// fastest run
+	long peakRssKb;				// largest peak RSS of all runs
+	long allocations;			// -1 if not counted
+	long allocatedBytes;
+	int failed;					// 1 if a command didn't return 0
+};
+
+struct benchCase {
+	const char *name;
+	const char *input;			// file whose lines and bytes are reported
+	int numSteps;
+	char *argv[MAXSTEPS][MAXARGS];	// commands run one after the other, each argv ends with NULL
+};
+
+int runCommand(char**, const char*, const char*, double*, long*);
+int runCase(struct benchCase*, int, const char*, const char*, struct measure*);
+int countLines(const char*, long*, long*);
+int sameFiles(const char*, const char*);
+double wallTime(void);
+
+
+int main (int argc, char* argv[]) {
+	int repeats = 5;
+	const char *version = "unknown";
+	char preload[4200];
+	char tempDir[] = "/tmp/benchXXXXXX";
+	char asmHex[4200], text[4200], textHex[4200], scratch[4200], counts[4200];
+	struct benchCase cases[4];
+	struct measure result;
+	long lines, bytes;
+	int i, numCases = 0, status = 0;
+	char *slash;
+
+	/***********		Read options		************/
+	snprintf(preload, sizeof(preload), "%s", argv[0]);		// default alloccount.so is next to this program
+	slash = strrchr(preload, '/');
+	snprintf(slash ? slash+1 : preload, sizeof(preload) - (slash ? slash+1-preload : 0), "alloccount.so");
+	while (argc > 2 && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-n") == 0)
+			repeats = atoi(argv[2]);
+		else if (strcmp(argv[1], "-v") == 0)
+			version = argv[2];
+		else if (strcmp(argv[1], "-a") == 0)
+			snprintf(preload, sizeof(preload), "%s", argv[2]);
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc != 6 || repeats <= 0) {
+		printf(HELP);
+		return 0;
+	}
+	if (preload[0] != '/' && realpath(preload, scratch) != NULL)	// LD_PRELOAD needs a path valid from any directory
+		snprintf(preload, sizeof(preload), "%s", scratch);
+	if (access(preload, R_OK) != 0)
+		preload[0] = '\0';
+	if (mkdtemp(tempDir) == NULL) {
+		printf("Can't create a temporary directory.\n");
+		return 18;
+	}
+	snprintf(asmHex, sizeof(asmHex), "%s/a.hex", tempDir);
+	snprintf(text, sizeof(text), "%s/a.txt", tempDir);
+	snprintf(textHex, sizeof(textHex), "%s/b.hex", tempDir);
+	snprintf(scratch, sizeof(scratch), "%s/d.txt", tempDir);
+	snprintf(counts, sizeof(counts), "%s/counts", tempDir);
+
+
+	/***********		Cases		************/
+	memset(cases, 0, sizeof(cases));
+	cases[numCases].name = "assemble";
+	cases[numCases].input = argv[4];
+	cases[numCases].numSteps = 1;
+	memcpy(cases[numCases++].argv[0], (char *[]){argv[1], "-o", asmHex, argv[3], argv[4], NULL}, 6*sizeof(char *));
+
+	cases[numCases].name = "disassemble";
+	cases[numCases].input = argv[5];
+	cases[numCases].numSteps = 1;
+	memcpy(cases[numCases++].argv[0], (char *[]){argv[2], "-j", "1", argv[5], scratch, NULL}, 6*sizeof(char *));
+
+	cases[numCases].name = "disassembleParallel";
+	cases[numCases].input = argv[5];
+	cases[numCases].numSteps = 1;
+	memcpy(cases[numCases++].argv[0], (char *[]){argv[2], argv[5], scratch, NULL}, 4*sizeof(char *));
+
+	cases[numCases].name = "roundTrip";
+	cases[numCases].input = argv[4];
+	cases[numCases].numSteps = 3;
+	memcpy(cases[numCases].argv[0], (char *[]){argv[1], "-o", asmHex, argv[3], argv[4], NULL}, 6*sizeof(char *));
+	memcpy(cases[numCases].argv[1], (char *[]){argv[2], asmHex, text, NULL}, 4*sizeof(char *));
+	memcpy(cases[numCases++].argv[2], (char *[]){argv[1], "-o", textHex, argv[3], text, NULL}, 6*sizeof(char *));
+
+
+	/***********		Run them		************/
+	printf("{\"version\": \"%s\", \"repeats\": %d, \"results\": [\n", version, repeats);
+	for (i=0; i<numCases; i++) {
+		runCase(&cases[i], repeats, preload, counts, &result);
+		if (countLines(cases[i].input, &lines, &bytes) != 0)
+			lines = bytes = 0;
+		printf("  {\"name\": \"%s\", \"lines\": %ld, \"bytes\": %ld, \"seconds\": %.6f, \"linesPerSecond\": %.0f, "
+				"\"megabytesPerSecond\": %.2f, \"peakRssKb\": %ld, \"allocations\": %ld, \"allocatedBytes\": %ld, \"failed\": %s",
+				cases[i].name, lines, bytes, result.seconds, lines/result.seconds, bytes/result.seconds/1e6,
+				result.peakRssKb, result.allocations, result.allocatedBytes, result.failed ? "true" : "false");
+		if (strcmp(cases[i].name, "roundTrip") == 0)
+			printf(", \"identical\": %s", (!result.failed && sameFiles(asmHex, textHex)) ? "true" : "false");
+		printf("}%s\n", (i < numCases-1) ? "," : "");
+		if (result.failed)
+			status = 1;
+	}
+	printf("]}\n");
+
+	unlink(asmHex);
+	unlink(text);
+	unlink(textHex);
+	unlink(scratch);
+	unlink(counts);
+	rmdir(tempDir);
+	return status;
+}
+
+
+// FUNCTIONS DEFINITION
+int runCase(struct benchCase *benchCase, int repeats, const char *preload, const char *counts, struct measure *result) {
+	double seconds, total;
+	long rss, calls, bytes;
+	int run, step;
+	FILE *filePtr;
+
+	memset(result, 0, sizeof(struct measure));
+	result->seconds = -1;
+	for (run=0; run<repeats; run++) {
+		total = 0;
+		for (step=0; step<benchCase->numSteps; step++) {
+			if (runCommand(benchCase->argv[step], NULL, NULL, &seconds, &rss) != 0)
+				result->failed = 1;
+			total += seconds;
+			if (rss > result->peakRssKb)
+				result->peakRssKb = rss;
+		}
+		if (result->seconds < 0 || total < result->seconds)
+			result->seconds = total;
+	}
+
+	result->allocations = result->allocatedBytes = -1;
+	if (preload[0] == '\0')
+		return result->failed;
+	result->allocations = result->allocatedBytes = 0;
+	for (step=0; step<benchCase->numSteps; step++) {	// one more run, counting allocations
+		unlink(counts);
+		runCommand(benchCase->argv[step], preload, counts, &seconds, &rss);
+		if ((filePtr = fopen(counts, "r")) == NULL || fscanf(filePtr, "%ld %ld", &calls, &bytes) != 2) {
+			if (filePtr != NULL)
+				fclose(filePtr);
+			result->allocations = result->allocatedBytes = -1;
+			break;
+		}
+		fclose(filePtr);
+		result->allocations += calls;
+		result->allocatedBytes += bytes;
+	}
+	return result->failed;
+}
+
+
+int runCommand(char **argv, const char *preload, const char *counts, double *seconds, long *peakRssKb) {
+	// runs argv with standard output and error discarded; returns its exit status, -1 if it can't be run
+	struct rusage usage;
+	pid_t pid;
+	int status, fd;
+	double start = wallTime();
+
+	*seconds = 0;
+	*peakRssKb = 0;
+	if ((pid = fork()) < 0)
+		return -1;
+	if (pid == 0) {
+		if ((fd = open("/dev/null", O_WRONLY)) >= 0) {
+			dup2(fd, 1);
+			dup2(fd, 2);
+			close(fd);
+		}
+		if (preload != NULL) {
+			setenv("LD_PRELOAD", preload, 1);
+			setenv("ALLOCCOUNT_OUT", counts, 1);
+		}
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &usage) < 0)
+		return -1;
+	*seconds = wallTime() - start;
+	*peakRssKb = usage.ru_maxrss;			// kilobytes on Linux
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+
+int countLines(const char *fileName, long *lines, long *bytes) {
+	char buffer[65536];
+	size_t n, i;
+	FILE *filePtr;
+
+	*lines = *bytes = 0;
+	if ((filePtr = fopen(fileName, "rb")) == NULL)
+		return 1;
+	while ((n = fread(buffer, 1, sizeof(buffer), filePtr)) > 0) {
+		for (i=0; i<n; i++)
+			*lines += (buffer[i] == '\n');
+		*bytes += n;
+	}
+	fclose(filePtr);
+	return 0;
+}
+
+
+int sameFiles(const char *first, const char *second) {	// returns 1 if the files have the same content
+	FILE *a = fopen(first, "rb"), *b = fopen(second, "rb");
+	int c, d, same = (a != NULL && b != NULL);
+
+	while (same) {
+		c = getc(a);
+		d = getc(b);
+		if (c != d)
+			same = 0;
+		else if (c == EOF)
+			break;
+	}
+	if (a != NULL)
+		fclose(a);
+	if (b != NULL)
+		fclose(b);
+	return same;
+}
+
+
+double wallTime(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec*1e-9;
+}
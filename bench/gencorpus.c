@@ -0,0 +1,178 @@
+/*
+
+This program generates random valid programs for the benchmarks, using an instruction set file.
+
+	/// USAGE ///
+	gencorpus [-s seed] instructionSet asm|hex numLines output
+	 asm		assembly source: numLines lines of instructions with random operands written as .decimal or 0xhex,
+				with a comment or a blank line now and then and a label every 16 lines. Instructions with a single
+				operand of 11 bits or more (jumps) use a label as operand half of the times.
+	 hex		Intel hex image of numLines data records of 16 bytes, made of random valid instructions, with the
+				extended linear address records required every 64K, as written by the assembler.
+	The same seed (default 1) always gives the same file.
+
+	Build with: gcc -O2 -I.. gencorpus.c ../isa.c -o gencorpus (or make bench from the main directory)
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "isa.h"
+
+#define HELP "Usage: gencorpus [-s seed] instructionSet asm|hex numLines output\n"
+#define LABELEVERY 16		// lines between two labels of an asm file
+#define JUMPBITS 11			// operands this wide are addresses, so they can be labels
+#define HEXRECORD 16		// data bytes of a record of a hex file
+
+unsigned long long randomState = 1;
+
+unsigned int nextRandom(void);
+unsigned short randomWord(const struct instructionSet*, int*, int*);
+int writeAsm(FILE*, const struct instructionSet*, long);
+int writeHex(FILE*, const struct instructionSet*, long);
+void writeRecord(FILE*, int, unsigned int, const unsigned char*, int);
+
+
+int main (int argc, char* argv[]) {
+	struct instructionSet set;
+	FILE *filePtr;
+	long numLines;
+	int status;
+
+	if (argc > 2 && strcmp(argv[1], "-s") == 0) {
+		randomState = strtoull(argv[2], NULL, 10)*2 + 1;	// never 0, xorshift would stay 0
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc != 5 || (strcmp(argv[2], "asm") != 0 && strcmp(argv[2], "hex") != 0) || (numLines = atol(argv[3])) <= 0) {
+		printf(HELP);
+		return 0;
+	}
+	if (loadInstructionSet(argv[1], &set, 0) != 0) {
+		printf("Invalid instruction set file %s.\n", argv[1]);
+		return 1;
+	}
+	if ((filePtr = fopen(argv[4], "w")) == NULL) {
+		printf("Can't create %s.\n", argv[4]);
+		freeInstructionSet(&set);
+		return 18;
+	}
+
+	if (strcmp(argv[2], "asm") == 0)
+		status = writeAsm(filePtr, &set, numLines);
+	else
+		status = writeHex(filePtr, &set, numLines);
+	if (fclose(filePtr) != 0)
+		status = 18;
+	freeInstructionSet(&set);
+	if (status != 0)
+		printf("Can't write %s.\n", argv[4]);
+	return status;
+}
+
+
+// FUNCTIONS DEFINITION
+unsigned int nextRandom(void) {			// xorshift64*, same sequence on every system
+	randomState ^= randomState >> 12;
+	randomState ^= randomState << 25;
+	randomState ^= randomState >> 27;
+	return (randomState * 2685821657736338717ULL) >> 32;
+}
+
+
+unsigned short randomWord(const struct instructionSet *set, int *index, int *operands) {
+	// picks a random instruction with random operands; returns its word
+	const struct instruction *instr;
+	unsigned short word;
+	int j;
+
+	*index = nextRandom() % set->numInstructions;
+	instr = &set->instr[*index];
+	word = instr->opCode << instr->shiftOpCode;
+	for (j=0; j<instr->numOperands; j++) {
+		operands[j] = nextRandom() & ((1<<instr->maskOperand[j])-1);
+		word += operands[j] << instr->shiftOperand[j];
+	}
+	return word;
+}
+
+
+int writeAsm(FILE *filePtr, const struct instructionSet *set, long numLines) {
+	const struct instruction *instr;
+	int index, operands[2], j;
+	long line, numLabels = 0;
+
+	for (line=0; line<numLines; line++) {
+		if (line % LABELEVERY == 0) {
+			fprintf(filePtr, "L%ld:\n", numLabels++);
+			continue;
+		}
+		switch (nextRandom() % 32) {
+			case 0:
+				fprintf(filePtr, "; comment line %ld\n", line);
+				continue;
+			case 1:
+				fprintf(filePtr, "\n");
+				continue;
+		}
+		randomWord(set, &index, operands);
+		instr = &set->instr[index];
+		fprintf(filePtr, "\t%s", instr->name);
+		if (instr->numOperands == 1 && instr->maskOperand[0] >= JUMPBITS && (nextRandom() & 1)) {
+			fprintf(filePtr, " L%ld\n", nextRandom() % (numLines/LABELEVERY + 1));	// backward or forward, all are defined
+			continue;
+		}
+		for (j=0; j<instr->numOperands; j++) {
+			fprintf(filePtr, (j == 0) ? " " : ",");
+			if (nextRandom() & 1)
+				fprintf(filePtr, ".%d", operands[j]);
+			else
+				fprintf(filePtr, "0x%x", operands[j]);
+		}
+		if ((nextRandom() & 7) == 0)
+			fprintf(filePtr, "\t\t; comment");
+		fprintf(filePtr, "\n");
+	}
+	return ferror(filePtr) ? 18 : 0;
+}
+
+
+int writeHex(FILE *filePtr, const struct instructionSet *set, long numLines) {
+	unsigned char data[HEXRECORD], upper[2];
+	unsigned long address = 0;
+	unsigned short word;
+	int index, operands[2], i;
+	long line;
+
+	writeRecord(filePtr, 4, 0, (const unsigned char *)"\0\0", 2);	// program starts at 0
+	for (line=0; line<numLines; line++) {
+		if (address > 0 && (address & 0xffff) == 0) {		// HEXRECORD divides 64K, records never cross it
+			upper[0] = (address>>24) & 0xff;
+			upper[1] = (address>>16) & 0xff;
+			writeRecord(filePtr, 4, 0, upper, 2);
+		}
+		for (i=0; i<HEXRECORD; i+=2) {
+			word = randomWord(set, &index, operands);
+			data[i] = word & 0xff;					// low byte first
+			data[i+1] = word >> 8;
+		}
+		writeRecord(filePtr, 0, address & 0xffff, data, HEXRECORD);
+		address += HEXRECORD;
+	}
+	writeRecord(filePtr, 1, 0, NULL, 0);
+	return ferror(filePtr) ? 18 : 0;
+}
+
+
+void writeRecord(FILE *filePtr, int type, unsigned int address, const unsigned char *data, int length) {
+	unsigned int sum = length + (address>>8) + (address&0xff) + type;
+	int i;
+
+	fprintf(filePtr, ":%02x%04x%02x", length, address, type);
+	for (i=0; i<length; i++) {
+		fprintf(filePtr, "%02x", data[i]);
+		sum += data[i];
+	}
+	fprintf(filePtr, "%02x\n", (~sum + 1) & 0xff);
+}
@@ -0,0 +1,274 @@
+/*
+
+Latency benchmark of asmserver against the one-shot assembler and disassembler.
+
+	/// USAGE ///
+	latency [-n requests] [-c clients] server assembler disassembler instructionSet source.asm image.hex
+	The server is started on a temporary socket and stopped at the end. Cases:
+	 assembleOneShot		assembler is run requests times on source.asm (process start and instruction set loading included).
+	 disassembleOneShot		disassembler is run requests times on image.hex.
+	 assembleServer			source.asm is sent to the server requests times, by clients threads (default 1) at the same
+							time; each request opens its own connection, as a new process of asmclient would.
+	 disassembleServer		same with image.hex.
+	Files are read in memory once: the server cases measure connection, request, work and response.
+
+	/// OUTPUT ///
+	A JSON object on standard output with requests, clients and one element of results per case, with the latency of
+	requests in milliseconds (p50Ms, p99Ms, meanMs, maxMs), requestsPerSecond and failed (requests that didn't get a
+	response with status 0).
+
+	Build with: gcc -O2 -pthread -I.. latency.c ../protocol.c -o latency (or make latency from the main directory)
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "protocol.h"
+
+#define HELP "Usage: latency [-n requests] [-c clients] server assembler disassembler instructionSet source.asm image.hex\n"
+#define STARTTIMEOUT 5.0		// seconds waited for the server to accept connections
+
+struct serverCase {				// requests sent by the client threads of a server case
+	const char *socketName;
+	int command;
+	const char *name;
+	const char *data;
+	size_t size;
+	int numRequests;
+	int nextRequest;			// first request not sent yet, protected by lock
+	double *latency;			// latency[i] of request i
+	int numFailed;
+	pthread_mutex_t lock;
+};
+
+int runCommand(char**);
+void *clientThread(void*);
+void report(const char*, double*, int, double, int, int);
+int compareDoubles(const void*, const void*);
+int readFile(const char*, char**, size_t*);
+double wallTime(void);
+
+
+int main (int argc, char* argv[]) {
+	int numRequests = 200, numClients = 1;
+	char tempDir[] = "/tmp/latencyXXXXXX";
+	char socketName[4200], asmHex[4200], text[4200];
+	char *serverArgs[6], *assembleArgs[6], *disassembleArgs[6];
+	struct serverCase cases[2];
+	char *source, *image;
+	size_t sourceSize, imageSize;
+	double *latency, start, total;
+	pthread_t *threads;
+	pid_t server;
+	int i, c, fd, numFailed, status = 0;
+
+	/***********		Read options		************/
+	while (argc > 2 && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-n") == 0)
+			numRequests = atoi(argv[2]);
+		else if (strcmp(argv[1], "-c") == 0)
+			numClients = atoi(argv[2]);
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc != 7 || numRequests <= 0 || numClients <= 0) {
+		printf(HELP);
+		return 0;
+	}
+	if (readFile(argv[5], &source, &sourceSize) != 0 || readFile(argv[6], &image, &imageSize) != 0) {
+		printf("Can't read %s or %s.\n", argv[5], argv[6]);
+		return 16;
+	}
+	if (mkdtemp(tempDir) == NULL) {
+		printf("Can't create a temporary directory.\n");
+		return 18;
+	}
+	snprintf(socketName, sizeof(socketName), "%s/socket", tempDir);
+	snprintf(asmHex, sizeof(asmHex), "%s/a.hex", tempDir);
+	snprintf(text, sizeof(text), "%s/a.txt", tempDir);
+	latency = (double *)malloc(numRequests*sizeof(double));
+	threads = (pthread_t *)malloc(numClients*sizeof(pthread_t));
+
+	/***********		Start the server		************/
+	memcpy(serverArgs, (char *[]){argv[1], "-s", socketName, argv[4], NULL}, 5*sizeof(char *));
+	if ((server = fork()) == 0) {
+		if ((fd = open("/dev/null", O_WRONLY)) >= 0) {
+			dup2(fd, 1);
+			close(fd);
+		}
+		execv(argv[1], serverArgs);
+		_exit(127);
+	}
+	for (start = wallTime(); (fd = connectServer(socketName)) < 0 && wallTime() - start < STARTTIMEOUT; )
+		usleep(10000);
+	if (fd < 0) {
+		printf("The server didn't start.\n");
+		kill(server, SIGTERM);
+		waitpid(server, NULL, 0);
+		rmdir(tempDir);
+		return 18;
+	}
+	close(fd);
+
+	/***********		One-shot cases		************/
+	printf("{\"requests\": %d, \"clients\": %d, \"results\": [\n", numRequests, numClients);
+	memcpy(assembleArgs, (char *[]){argv[2], "-o", asmHex, argv[4], argv[5], NULL}, 6*sizeof(char *));
+	memcpy(disassembleArgs, (char *[]){argv[3], argv[4], argv[6], text, NULL}, 5*sizeof(char *));
+	for (c=0; c<2; c++) {
+		numFailed = 0;
+		total = wallTime();
+		for (i=0; i<numRequests; i++) {
+			start = wallTime();
+			if (runCommand(c == 0 ? assembleArgs : disassembleArgs) != 0)
+				numFailed++;
+			latency[i] = wallTime() - start;
+		}
+		report(c == 0 ? "assembleOneShot" : "disassembleOneShot", latency, numRequests, wallTime() - total, numFailed, 0);
+		if (numFailed > 0)
+			status = 1;
+	}
+
+	/***********		Server cases		************/
+	for (c=0; c<2; c++) {
+		memset(&cases[c], 0, sizeof(struct serverCase));
+		cases[c].socketName = socketName;
+		cases[c].command = (c == 0) ? REQASSEMBLE : REQDISASSEMBLE;
+		cases[c].name = (c == 0) ? argv[5] : argv[6];
+		cases[c].data = (c == 0) ? source : image;
+		cases[c].size = (c == 0) ? sourceSize : imageSize;
+		cases[c].numRequests = numRequests;
+		cases[c].latency = latency;
+		pthread_mutex_init(&cases[c].lock, NULL);
+		total = wallTime();
+		for (i=0; i<numClients; i++)
+			pthread_create(&threads[i], NULL, clientThread, &cases[c]);
+		for (i=0; i<numClients; i++)
+			pthread_join(threads[i], NULL);
+		pthread_mutex_destroy(&cases[c].lock);
+		report(c == 0 ? "assembleServer" : "disassembleServer", latency, numRequests, wallTime() - total, cases[c].numFailed, c == 1);
+		if (cases[c].numFailed > 0)
+			status = 1;
+	}
+	printf("]}\n");
+
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+	unlink(asmHex);
+	unlink(text);
+	rmdir(tempDir);
+	free(latency);
+	free(threads);
+	free(source);
+	free(image);
+	return status;
+}
+
+
+// FUNCTIONS DEFINITION
+int runCommand(char **argv) {	// runs argv with standard output and error discarded; returns its exit status
+	pid_t pid;
+	int status, fd;
+
+	if ((pid = fork()) < 0)
+		return -1;
+	if (pid == 0) {
+		if ((fd = open("/dev/null", O_WRONLY)) >= 0) {
+			dup2(fd, 1);
+			dup2(fd, 2);
+			close(fd);
+		}
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		return -1;
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+
+void *clientThread(void *arg) {
+	struct serverCase *serverCase = (struct serverCase *)arg;
+	struct response response;
+	double start;
+	int request, fd, failed;
+
+	for (;;) {
+		pthread_mutex_lock(&serverCase->lock);
+		request = serverCase->nextRequest++;
+		pthread_mutex_unlock(&serverCase->lock);
+		if (request >= serverCase->numRequests)
+			return NULL;
+
+		start = wallTime();
+		failed = 1;
+		if ((fd = connectServer(serverCase->socketName)) >= 0) {
+			if (sendRequest(fd, serverCase->command, 0, serverCase->name, serverCase->data, serverCase->size) == 0
+					&& readResponse(fd, &response) == 0) {
+				failed = (response.status != 0);
+				freeResponse(&response);
+			}
+			close(fd);
+		}
+		serverCase->latency[request] = wallTime() - start;
+		if (failed) {
+			pthread_mutex_lock(&serverCase->lock);
+			serverCase->numFailed++;
+			pthread_mutex_unlock(&serverCase->lock);
+		}
+	}
+}
+
+
+void report(const char *name, double *latency, int count, double seconds, int numFailed, int last) {
+	// prints the JSON element of a case; latency is sorted
+	double sum = 0;
+	int i;
+
+	qsort(latency, count, sizeof(double), compareDoubles);
+	for (i=0; i<count; i++)
+		sum += latency[i];
+	printf("  {\"name\": \"%s\", \"p50Ms\": %.3f, \"p99Ms\": %.3f, \"meanMs\": %.3f, \"maxMs\": %.3f, "
+			"\"requestsPerSecond\": %.0f, \"failed\": %d}%s\n", name, 1000*latency[count/2], 1000*latency[(count*99)/100],
+			1000*sum/count, 1000*latency[count-1], count/seconds, numFailed, last ? "" : ",");
+	fflush(stdout);
+}
+
+
+int compareDoubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+
+int readFile(const char *fileName, char **data, size_t *size) {
+	struct stat info;
+	FILE *filePtr;
+
+	if ((filePtr = fopen(fileName, "rb")) == NULL)
+		return 1;
+	if (fstat(fileno(filePtr), &info) != 0 || (*data = (char *)malloc(info.st_size + 1)) == NULL) {
+		fclose(filePtr);
+		return 1;
+	}
+	*size = fread(*data, 1, info.st_size, filePtr);
+	fclose(filePtr);
+	return (*size == (size_t)info.st_size) ? 0 : 1;
+}
+
+
+double wallTime(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec*1e-9;
+}
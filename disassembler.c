@@ -3,267 +3,218 @@
 This disassembler is made for pic16f627a.
 
 	/// FILES REQUIRED ///
-	In order to launch the program correctly, 2 files needs to be passed as argument:
+	In order to launch the program correctly, 3 files needs to be passed as argument:
+	 - instruction set file:	same format used by the assembler (ex: pic16f627a_InS.txt).
 	 - source file: 		a file containing hex coded instructions to translate.
 	 - destination file: 	a file that will contain instructions translated.
+
+	If the instruction set was compiled with isacompiler and its .bin file is up to date, the .bin file (with the
+	decode table already built) is mapped instead; a .bin file can also be passed directly.
+
+	/// DECODING ///
+	All 2^14 words are decoded once at startup into decodeTable, using masks and shifts of the instruction set:
+	bits from opCode shift up to bit 13 must be equal to opCode, operands are extracted with their mask and shift.
+	Words that match no instruction are printed as "dw 0x...." instead of being dropped.
+	Operands are printed in decimal (btfsc .18,.3); with option -x (before the files) they are printed in hex, in the
+	syntax accepted by the assembler (btfsc 0x12,0x3). Lines are written by dislib.c without printf, see dislib.h.
+
+	/// HEX FILE ///
+	The source file is memory mapped (or read in memory if it is a pipe, '-' is standard input) and examined one record
+	(one line) at a time. The whole record is converted from hex characters to bytes in one pass, 16 characters at a time
+	with SSE2 when available, and its checksum is verified. Records of any legal length (up to 255 data bytes) are accepted.
+	Corrupted records are reported with their line number and skipped; in that case the program returns 20.
+	If the destination file can't be written (disk full, ...) the program returns 18.
+	Data words are formed with the low byte first; a word can be split between two records.
+	Words follow each other as the assembler would place them: "org 0x...." is written where the address jumps, the
+	word at 0x2007 is written as "__config 0x...." and bytes of data EEPROM (0x2100-0x217f) as "de 0x..".
+
+	/// LABELS ///
+	Option -l (before the files) writes a labelled disassembly instead, that the assembler turns back into the same
+	words: targets of goto and call get a label (f_xxxx if called, l_xxxx otherwise) used by the instructions that
+	jump there, basic blocks are separated by an empty line and addresses missing from the file by "org 0x....".
+	Option -g graph.dot also writes the call graph in DOT (implies -l). The words of the whole file are put in pages
+	by address, then two linear passes mark targets and blocks in bitsets and write the text (see dislib.h); -j is
+	not used. With --stats, parse is the time taken to read the records into the pages and format both passes.
+
+	/// THREADS ///
+	Option -j n (before the files) sets how many threads disassemble the file (default: number of cores).
+	The file is split in chunks at record boundaries (only after a data record that ends on a word boundary, so no word
+	is split between chunks); each chunk starts from the extended address of the records before it, and an org is put
+	in front of its text when it doesn't go on from the address where the chunk before it ended. Threads take chunks one at a time and write their text in a buffer of the chunk; buffers and
+	errors are then written in file order, so the destination file is the same for any number of threads.
+	Disassembling is done by dislib.c on text in memory (see dislib.h): this program only reads and writes files.
+
+	/// STATS ///
+	Option --stats (before the files) prints, instead of "Destination file created", a JSON object with the time of
+	each phase (read, parse, decode, format, write) and counters of records. Parse, decode and format are timed on
+	1 record in 64 and estimated; the time of the phases is summed over all threads, so with many threads it can be
+	longer than the run. Without --stats nothing is timed.
+	Build with: gcc -O2 -pthread disassembler.c dislib.c isa.c stats.c source.c -o disassembler (or make)
  
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include "isa.h"
+#include "dislib.h"
+#include "source.h"
 
-#define FMASK  0x007f				// mask used for f variable. 					Corresponds to (00)00 0000 0111 1111
-#define DMASK  0x0001				// mask used for d variable. 					Corresponds to (00)00 0000 0000 0001
-#define BMASK  0x0007				// mask used for b variable.					Corresponds to (00)00 0000 0000 0111
-#define KMASKS 0x00ff				// mask used for k variable, short version. 	Corresponds to (00)00 0000 1111 1111
-#define KMASKL 0x07ff 				// mask used for k variable, long version.  	Corresponds to (00)00 0111 1111 1111
+void printStats(FILE*, const struct phaseTimer*, unsigned long long, unsigned long long, struct tickClock*, int, int);
 
-int fprintInstr(int, FILE*);		// argument are instruction to disassemble and destination file
-int swapData(short*);				// function used to swap bytes of data
+int main (int argc, char* argv[]){
+	FILE *destFilePtr;
 
-union instrWord {					// each word of 2 bytes corresponds to an instruction
-	short fullWord;					// fullWord is used to access to the full word
-	char byteWord[2];				// byteWord[0] and byteWord[1] are used to access first byte and second byte of word
-};
+	int i, status;
+	struct sourceText source;		// hex file, records are converted directly from it
+	int numThreads = 0;				// 0 = number of cores
+	struct recordError *errors;		// corrupted records, in file order
+	int numErrors;
+	struct instructionSet isa;		// instructions and decodeTable, read only for all threads
+	int wantStats = 0;
+	int style = OPERANDDECIMAL;		// -x: OPERANDHEX
+	int labelled = 0;				// -l
+	const char *graphName = NULL;	// -g: file of the call graph
+	struct wordImage image;			// words by address, for -l
+	struct textBuffer text, graph;
+	FILE *graphFilePtr = NULL;
+	const char *unwritten = NULL;	// file that couldn't be written, if any
+	struct phaseTimer phases;		// filled only with --stats
+	struct tickClock clock;			// ticks => seconds, for --stats
+	unsigned long long isaTicks, tick;
+
+
+/****************		Read options		***************/
+
+	while (argc > 1) {
+		if (strcmp(argv[1], "-j") == 0 && argc > 2) {
+			numThreads = atoi(argv[2]);
+			argc--;						// shift options away
+			argv++;
+		}
+		else if (strcmp(argv[1], "--stats") == 0)
+			wantStats = 1;
+		else if (strcmp(argv[1], "-x") == 0)
+			style = OPERANDHEX;
+		else if (strcmp(argv[1], "-l") == 0)
+			labelled = 1;
+		else if (strcmp(argv[1], "-g") == 0 && argc > 2) {
+			labelled = 1;
+			graphName = argv[2];
+			argc--;
+			argv++;
+		}
+		else
+			break;
+		argc--;
+		argv++;
+	}
+	memset(&phases, 0, sizeof(phases));
+	startClock(&clock);
+	isaTicks = readTicks();
 
 
-int main (int argc, char* argv[]){
-	FILE *sourceFilePtr;
-	FILE *destFilePtr;
+/****************		Load instruction set		***************/
+
+	if (argc < 4 || loadInstructionSet(argv[1], &isa, 1) != 0) {	// compiled .bin is mapped if up to date, otherwise text is parsed
+		printf("Insert a valid instruction set file as FIRST argument.\n");
+		return 14;
+	}
+	argc--;							// shift instruction set away, so source and destination are always argv[1] and argv[2]
+	argv++;
 
-	int i;
-	char hexString[50];				// this will contain hex coded instructions
-	char stringTemp[5];				// this will be used to store characters that needs to be converted in numbers
-	int numBytes;					// this will contain first field of hex coded instruction (number of data bytes)
-	int dataType;
-	int numCharData;
-	short oneData;					// this will contain one instruction uncoded (14-bit opcode)
+
+	isaTicks = readTicks() - isaTicks;
 
 
 /****************		Check if files could be opened		***************/
 
-	if ((sourceFilePtr=fopen(argv[1], "r"))==NULL)	{
-		printf("Insert a valid source file as FIRST argument.\nInsert a valid destination file as SECOND argument.\n");
+	tick = readTicks();
+	if (argc < 3 || loadSource(argv[1], &source) != 0)	{
+		printf("Insert a valid source file as SECOND argument.\nInsert a valid destination file as THIRD argument.\n");
 		return 15;
 	}
 
 	if ((destFilePtr=fopen(argv[2], "w"))==NULL)	{
-		printf("Insert a valid destination file as SECOND argument.\n");
+		printf("Insert a valid destination file as THIRD argument.\n");
 		return 16;
 	}
+	phases.ticks[DISREAD] = readTicks() - tick;
+	phases.samples[DISREAD] = phases.events[DISREAD] = 1;
 
 
 /****************		Instructions processing			*************/
 
-	while(fscanf(sourceFilePtr, "%s", hexString) != EOF) {		// examine one hex coded instruction
-		strncpy(stringTemp, hexString+1, 2);					// extract second and third hex numbers
-		stringTemp[2]='\0';
-        numBytes = (int)strtol(stringTemp, NULL, 16);			// numBytes acquired
-
-		strncpy(stringTemp, hexString+7, 2);					// extract eigth and ninth hex numbers
-		stringTemp[2]='\0';
-		dataType = (int)strtol(stringTemp, NULL, 16);			// data type acquired
-
-		if(dataType == 1) {
-			fprintf(destFilePtr, "%s\n", "END");				// dataType equal to 01 corresponds to END
-		}
-
-		else if (dataType == 0) {								// dataType equal to 00 corresponds to data
-			numCharData = numBytes*2;							// each data is made of 2 bytes, so each data is made of 4 hex characters
-			for(i=9; i < (numCharData+9); i=i+4) {				// i starts from 9, which is when data field begins	:02400e00183f59
-				// i ends at index numCharData+9
-				// i is incremented by 4 because 1 data occupies 
-				strncpy(stringTemp, hexString+i, 4);			// extract data words (4 bytes each)
-				stringTemp[4]='\n';
-				oneData = (short)strtol(stringTemp, NULL, 16);	// dataWord acquired (now is no more a string)
-				swapData(&oneData);								// swapping bytes (required due to implementation in pic16f627a)
-				fprintInstr(oneData, destFilePtr);
-			}
+	if (graphName != NULL && (graphFilePtr = fopen(graphName, "w")) == NULL) {
+		printf("The call graph can't be written in %s.\n", graphName);
+		return 16;
+	}
+	if (labelled) {					// whole file in an array by address, then two passes over it
+		memset(&image, 0, sizeof(image));
+		memset(&text, 0, sizeof(text));
+		memset(&graph, 0, sizeof(graph));
+		tick = readTicks();
+		status = readHexWords(source.data, source.size, &image, &errors, &numErrors);
+		tick = lapPhase(&phases, DISPARSE, tick);
+		if (status != 17 && disassembleLabelled(&isa, &image, style, &text, graphFilePtr ? &graph : NULL) != 0)
+			status = 17;
+		tick = lapPhase(&phases, DISFORMAT, tick);
+		if (status != 17 && fwrite(text.text, 1, text.length, destFilePtr) != text.length)
+			unwritten = argv[2];
+		if (graphFilePtr != NULL) {
+			i = (status != 17 && fwrite(graph.text, 1, graph.length, graphFilePtr) != graph.length);
+			if (fclose(graphFilePtr) != 0 || i)
+				unwritten = graphName;
 		}
+		lapPhase(&phases, DISWRITE, tick);
+		phases.events[DISPARSE] = phases.events[DISFORMAT] = phases.events[DISWRITE] = 1;
+		free(text.text);
+		free(graph.text);
+		freeWordImage(&image);
+	}
+	else	// text goes straight to the destination file: with one chunk while it is made, otherwise chunk by chunk in file order
+		status = disassembleHex(&isa, source.data, source.size, numThreads, style, destFilePtr, NULL, &errors, &numErrors, wantStats ? &phases : NULL);
+	for (i=0; i<numErrors; i++)
+		fprintf(stderr, "%s:%d: error: %s\n", argv[1], errors[i].line, recordErrorText(errors[i].code));
+	free(errors);
+
+	freeSource(&source);
+	if (fclose(destFilePtr) != 0 || status == 18)	// text kept by stdio is written by fclose
+		unwritten = argv[2];
+	freeInstructionSet(&isa);
+
+	if (status == 17) {
+		printf("Not enough memory to disassemble %s.\n", argv[1]);
+		return 17;
+	}
+	if (unwritten != NULL) {
+		printf("Can't write %s.\n", unwritten);
+		return 18;
+	}
+	if (wantStats)
+		printStats(stdout, &phases, isaTicks, readTicks() - clock.ticks, &clock, (numThreads > 0) ? numThreads : (int)sysconf(_SC_NPROCESSORS_ONLN), numErrors);
+	else
+		printf("Destination file %s created.\n", argv[2]);
+	if (numErrors > 0) {
+		printf("%d corrupted records skipped.\n", numErrors);
+		return 20;
 	}
-
-	fclose(sourceFilePtr);
-	fclose(destFilePtr);
-
-	printf("Destination file %s created.\n", argv[2]);
 	return 0;
 }
 
 
 // FUNCTIONS DEFINITION
 
-int fprintInstr(int instr, FILE* filePtr){
-	int f, d, b, k;				// the letters used for these variables are the same as in the data sheet
-	// first I check if instr is without parameters (constant)
-	if (instr == 0x0100) 		fprintf(filePtr, "%s\n", "clrw");	// CLEAR W
-	else if(instr == 0x0000) 	fprintf(filePtr, "%s\n", "nop");	// NO OPERATION
-	else if(instr == 0x0064)	fprintf(filePtr, "%s\n", "clrwdt");	// CLEAR WATCHDOG TIMER
-	else if(instr == 0x0009)	fprintf(filePtr, "%s\n", "retfie");	// RETURN FROM INTERRUPT
-	else if(instr == 0x0008)	fprintf(filePtr, "%s\n", "return");	// RETURN FROM SUBROUTINE
-	else if(instr == 0x0063)	fprintf(filePtr, "%s\n", "sleep");	// GO IN STANDBY MODE
-	else {
-		switch (instr>>12) {
-			case 0x0:			// byte-oriented register file operations
-				if ((instr>>8) == 7) {			// ADD W and F
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "addwf", f, d);
-				}
-				else if ((instr>>8) == 5) {		// AND W with F
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "andwf", f, d);
-				}
-				else if ((instr>>8) == 1) {		// CLEAR F
-					f = instr&(FMASK);
-					fprintf(filePtr, "%s .%d\n", "clrf", f);
-				}
-				else if ((instr>>8) == 9) {		// COMPLEMENT F
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "comf", f, d);					
-				}
-				else if ((instr>>8) == 3) {		// DECREMENT F
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "decf", f, d);					
-				}
-				else if ((instr>>8) == 11) {	// DECREMENT F, SKIP IF 0
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "decfsz", f, d);					
-				}
-				else if ((instr>>8) == 10) {	// INCREMENT F
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "incf", f, d);					
-				}
-				else if ((instr>>8) == 15) {	// INCREMENT F, SKIP IF 0
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "incfsz", f, d);					
-				}
-				else if ((instr>>8) == 4){		// INCLUSIVE OR W with F
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "iorwf", f, d);					
-				}
-				else if ((instr>>8) == 8){		// MOVE F
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "movf", f, d);					
-				}
-				else if ((instr>>8) == 0){		// MOVE W TO F
-					f = instr&(FMASK);
-					fprintf(filePtr, "%s .%d\n", "movwf", f);
-				}
-				else if ((instr>>8) == 13){		// ROTATE LEFT F TRHROUGH CARRY
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "rlf", f, d);					
-				}
-				else if ((instr>>8) == 12){		// ROTATE RIGHT F THROUGH CARRY
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "rrf", f, d);					
-				}
-				else if ((instr>>8) == 2){		// SUBTRACT W from F
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "subwf", f, d);					
-				}
-				else if ((instr>>8) == 14){		// SWAP NIBBLES IN F
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "swapf", f, d);					
-				}
-				else if ((instr>>8) == 6){		// EXCLUSIVE OR W with F
-					f = instr&(FMASK);
-					d = (instr>>7)&(DMASK);
-					fprintf(filePtr, "%s .%d,.%d\n", "xorwf", f, d);					
-				}
-				break;
-			case 0x1:			// bit-oriented register file operations
-				if ((instr>>10) == 4){		// BIT CLEAR F
-					f = instr&(FMASK);
-					b = (instr>>7)&(BMASK);	
-					fprintf(filePtr, "%s .%d,.%d\n", "bcf", f, b);
-				}
-				else if((instr>>10) == 5){	// BIT SET F
-					f = instr&(FMASK);
-					b = (instr>>7)&(BMASK);	
-					fprintf(filePtr, "%s .%d,.%d\n", "bsf", f, b);
-				}
-				else if((instr>>10) == 6){	// BIT TEST F, SKIP IF CLEAR
-					f = instr&(FMASK);
-					b = (instr>>7)&(BMASK);	
-					fprintf(filePtr, "%s .%d,.%d\n", "btfsc", f, b);
-				}
-				else if((instr>>10) == 7){	// BIT TEST F, SKIP IF SET
-					f = instr&(FMASK);
-					b = (instr>>7)&(BMASK);	
-					fprintf(filePtr, "%s .%d,.%d\n", "btfss", f, b);
-				}
-				break;
-			case 0x2:			// literal and control operations
-
-				if ((instr>>11) == 4){		// CALL SUBROUTINE
-					k = instr&(KMASKL);
-					fprintf(filePtr, "%s .%d\n", "call", k);
-				}
-				else if ((instr>>11) == 5){	// GO TO ADDRESS
-					k = instr&(KMASKL);
-					fprintf(filePtr, "%s .%d\n", "goto", k);
-				}
-				break;
-			case 0x3:			// literal and control operations
-				if ((instr>>9) == 0x1f){	// ADD LITERAL and W
-					k = instr&(KMASKS);
-					fprintf(filePtr, "%s .%d\n", "addlw", k);
-				}
-				else if((instr>>8) == 0x39){	// AND LITERAL with W
-					k = instr&(KMASKS);
-					fprintf(filePtr, "%s .%d\n", "andlw", k);
-				}
-				else if((instr>>8) == 0x38){	// INCLUSIVE OR LITERAL with W
-					k = instr&(KMASKS);
-					fprintf(filePtr, "%s .%d\n", "iorlw", k);
-				}
-				else if((instr>>10) == 0xc){	// MOVE LITERAL to W
-					k = instr&(KMASKS);
-					fprintf(filePtr, "%s .%d\n", "movlw", k);
-				}
-				else if((instr>>10) == 0xd){	// RETURN WITH LITERAL in W
-					k = instr&(KMASKS);
-					fprintf(filePtr, "%s .%d\n", "retlw", k);
-				}
-				else if((instr>>9) == 0x1e){	// SUBTRACT W from LITERAL
-					k = instr&(KMASKS);
-					fprintf(filePtr, "%s .%d\n", "sublw", k);
-				}
-				else if((instr>>8) == 0x3a){	// EXCLUSIVE OR LITERAL with W
-					k = instr&(KMASKS);
-					fprintf(filePtr, "%s .%d\n", "xorlw", k);
-				}
-				break;
-			default:
-				break;
-		}
-	}
-	return 0;
+void printStats(FILE *filePtr, const struct phaseTimer *phases, unsigned long long isaTicks, unsigned long long totalTicks,
+		struct tickClock *clock, int numThreads, int numErrors) {
+	// prints the JSON object of --stats: time of each phase and counters of records
+	static const char* const phaseName[NUMDISPHASES] = {"read", "parse", "decode", "format", "write"};
+	double rate = tickRate(clock);
+
+	fprintf(filePtr, "{\n  \"tool\": \"disassembler\",\n  \"isaLoadSeconds\": %.6f,\n  \"seconds\": %.6f,\n  \"threads\": %d,\n",
+			isaTicks/rate, totalTicks/rate, numThreads);
+	printPhases(filePtr, phaseName, NUMDISPHASES, phases, rate);
+	fprintf(filePtr, ",\n  \"counters\": {\"records\": %lu, \"dataRecords\": %lu, \"corruptedRecords\": %d, \"writes\": %lu}\n}\n",
+			phases->events[DISPARSE], phases->events[DISDECODE], numErrors, phases->events[DISWRITE]);
 }
-
-
-int swapData(short* hexToSwap) {
-	union instrWord swapper;			// swapper is a temp variable used to swap bytes (2 with 2)
-	char byteTemp;
-
-	swapper.fullWord = *hexToSwap;				// loading entire word in swapper
-	byteTemp = swapper.byteWord[1];				// swap first 2 bytes with other 2 bytes
-	swapper.byteWord[1] = swapper.byteWord[0];
-	swapper.byteWord[0] = byteTemp;
-
-	*hexToSwap = swapper.fullWord;
-	return 0;
-}
\ No newline at end of file
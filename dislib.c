@@ -0,0 +1,956 @@
+/*
+
+Disassembler library, see dislib.h.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "dislib.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define CHUNKSPERTHREAD 8			// chunks are smaller than a thread's share, so threads finishing early take more
+#define MINCHUNK   65536			// smaller chunks are not worth a thread
+#define FLUSHTEXT  (1<<20)			// text kept in memory by a chunk that writes directly to the destination file
+
+static const char *errorText[] = {"",
+	"record doesn't start with ':' or has an odd number of characters",
+	"record contains characters that are not hex digits",
+	"record length doesn't match its length field",
+	"wrong checksum"};
+
+static char *putOrg(char*, unsigned long);
+
+
+int disassembleWords(const struct instructionSet *set, const unsigned short *words, size_t count, int style, struct textBuffer *output) {
+	struct format format;
+	unsigned int block[256];
+	size_t i;
+	int n;
+
+	setupFormat(&format, set, style);
+	for (i=0; i<count; i += n) {				// space is reserved once per block of words
+		for (n=0; n<256 && i+n < count; n++)
+			block[n] = words[i+n];
+		if (formatWords(block, n, &format, output) != 0)
+			return 17;
+	}
+	return output->error ? 17 : 0;
+}
+
+
+int disassembleHex(const struct instructionSet *set, const char *hex, size_t size, int numThreads, int style, FILE *sink,
+		struct textBuffer *output, struct recordError **errors, int *numErrors, struct phaseTimer *phases) {
+	struct disassembly job;
+	pthread_t *threads;
+	struct chunk *chunk;
+	struct recordError *allErrors;
+	int i, j, status = 0;
+	int firstLine = 0;				// lines before current chunk
+	unsigned long long tick = 0;
+	unsigned long next = 0;			// address after the words of the chunks merged so far
+	char org[MAXLINE];
+	size_t orgLength;
+
+	*errors = NULL;
+	*numErrors = 0;
+	if (numThreads <= 0)
+		numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	setupFormat(&job.format, set, style);
+	if ((job.numChunks = splitChunks(hex, size, numThreads, &job.chunks)) < 0)
+		return 17;
+	job.nextChunk = 0;
+	job.timePhases = (phases != NULL);
+	pthread_mutex_init(&job.lock, NULL);
+	if (numThreads > job.numChunks)
+		numThreads = job.numChunks;
+	if (job.numChunks == 1)							// serial: no need to keep the whole text in memory
+		job.chunks[0].sink = sink;
+	if ((threads = (pthread_t *)malloc(numThreads*sizeof(pthread_t))) == NULL)
+		numThreads = 1;
+	for (i=1; i<numThreads; i++)
+		pthread_create(&threads[i], NULL, disassemblyWorker, &job);
+	disassemblyWorker(&job);						// calling thread works too
+	for (i=1; i<numThreads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&job.lock);
+	free(threads);
+
+	for (i=0; i<job.numChunks; i++) {				// merge chunks in file order
+		chunk = &job.chunks[i];
+		orgLength = 0;
+		if (i > 0 && chunk->addressKnown && chunk->firstAddress != next)	// the chunk doesn't go on from the one before
+			orgLength = putOrg(org, chunk->firstAddress) - org;
+		if (chunk->addressKnown)
+			next = chunk->next;
+		if (sink != NULL) {
+			if (phases != NULL)
+				tick = readTicks();
+			if (fwrite(org, 1, orgLength, sink) != orgLength
+					|| fwrite(chunk->output.text, 1, chunk->output.length, sink) != chunk->output.length)
+				chunk->writeError = 1;
+			if (phases != NULL) {
+				chunk->phases.events[DISWRITE]++;
+				lapPhase(&chunk->phases, DISWRITE, tick);
+			}
+		}
+		else if (appendText(output, org, orgLength) != 0 || appendText(output, chunk->output.text, chunk->output.length) != 0)
+			status = 17;
+		if (chunk->output.error)
+			status = 17;
+		else if (chunk->writeError && status == 0)
+			status = 18;
+		for (j=0; j<chunk->numErrors; j++)			// lines become lines of the whole file
+			chunk->errors[j].line += firstLine;
+		if (*numErrors == 0) {						// errors of the first chunk that has them are kept...
+			*errors = chunk->errors;
+			*numErrors = chunk->numErrors;
+			chunk->errors = NULL;
+		}
+		else if (chunk->numErrors > 0) {			// ...the others are appended
+			allErrors = (struct recordError *)realloc(*errors, (*numErrors + chunk->numErrors)*sizeof(struct recordError));
+			if (allErrors == NULL)
+				status = 17;
+			else {
+				memcpy(allErrors + *numErrors, chunk->errors, chunk->numErrors*sizeof(struct recordError));
+				*errors = allErrors;
+				*numErrors += chunk->numErrors;
+			}
+		}
+		firstLine += chunk->numLines;
+		if (phases != NULL)
+			addPhases(phases, &chunk->phases);		// time of all threads
+		free(chunk->output.text);
+		free(chunk->errors);
+	}
+	free(job.chunks);
+	if (status == 0 && *numErrors > 0)
+		status = 20;
+	return status;
+}
+
+
+const char *recordErrorText(int code) {			// description of a code returned by parseRecord
+	return (code > 0 && code < (int)(sizeof(errorText)/sizeof(errorText[0]))) ? errorText[code] : "unknown error";
+}
+
+
+void setupFormat(struct format *format, const struct instructionSet *set, int style) {
+	// makes the table of mnemonics: name and the character after it, ready to be copied with one fixed-size memcpy
+	int i, length;
+
+	memset(format->mnemonic, 0, sizeof(format->mnemonic));
+	for (i=0; i<set->numInstructions && i<INVALIDOP; i++) {
+		length = strnlen(set->instr[i].name, sizeof(set->instr[i].name));
+		memcpy(format->mnemonic[i].text, set->instr[i].name, length);
+		format->mnemonic[i].text[length] = (set->instr[i].numOperands == 0) ? '\n' : ' ';
+		format->mnemonic[i].length = length + 1;
+	}
+	format->decodeTable = set->decodeTable;
+	format->style = style;
+}
+
+
+int formatWords(const unsigned int *words, int count, const struct format *format, struct textBuffer *output) {
+	// appends the lines of count words: space is reserved once, then lines are written without checks
+	char *end;
+	int i;
+
+	if (reserveText(output, (size_t)count*MAXLINE) != 0)
+		return 1;
+	end = output->text + output->length;
+	for (i=0; i<count; i++)
+		end = formatInstr(end, words[i], format);
+	output->length = end - output->text;
+	return 0;
+}
+
+
+static inline char *putDecimal(char *text, unsigned int value) {
+	// writes value (< 100000) without leading zeros, returns the end; stores 8 bytes, text must have room for them
+	int numDigits = 1 + (value >= 10) + (value >= 100) + (value >= 1000) + (value >= 10000);
+	unsigned long long digits;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	digits = ((unsigned long long)('0' + value/10000) << 56) | ((unsigned long long)('0' + value/1000%10) << 48)
+			| ((unsigned long long)('0' + value/100%10) << 40) | ((unsigned long long)('0' + value/10%10) << 32)
+			| ((unsigned long long)('0' + value%10) << 24);
+	digits <<= 8*(5-numDigits);						// leading zeros out, first digit in the first byte
+#else
+	digits = (unsigned long long)('0' + value/10000) | ((unsigned long long)('0' + value/1000%10) << 8)
+			| ((unsigned long long)('0' + value/100%10) << 16) | ((unsigned long long)('0' + value/10%10) << 24)
+			| ((unsigned long long)('0' + value%10) << 32);
+	digits >>= 8*(5-numDigits);
+#endif
+	memcpy(text, &digits, 8);
+	return text + numDigits;
+}
+
+
+static inline char *putHex(char *text, unsigned int value, int numDigits) {
+	// writes the numDigits (1 to 4) low hex digits of value, returns the end; stores 4 bytes
+	static const char hexDigit[] = "0123456789abcdef";
+	unsigned int digits;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	digits = (hexDigit[(value>>12)&15] << 24) | (hexDigit[(value>>8)&15] << 16) | (hexDigit[(value>>4)&15] << 8) | hexDigit[value&15];
+	digits <<= 8*(4-numDigits);
+#else
+	digits = hexDigit[(value>>12)&15] | (hexDigit[(value>>8)&15] << 8) | (hexDigit[(value>>4)&15] << 16) | ((unsigned int)hexDigit[value&15] << 24);
+	digits >>= 8*(4-numDigits);
+#endif
+	memcpy(text, &digits, 4);
+	return text + numDigits;
+}
+
+
+static inline char *putOperand(char *text, unsigned int value, int style) {
+	if (style == OPERANDHEX) {
+		text[0] = '0';
+		text[1] = 'x';
+		return putHex(text+2, value, 1 + (value >= 0x10) + (value >= 0x100) + (value >= 0x1000));
+	}
+	text[0] = '.';
+	return putDecimal(text+1, value);
+}
+
+
+char *formatInstr(char *text, unsigned int instr, const struct format *format) {
+	// writes the line of instr at text (MAXLINE bytes available), returns its end
+	const struct decodeEntry *entry;
+	const struct mnemonic *name;
+
+	instr &= 0xffff;									// instr comes from a short, drop sign extension
+	if (instr >= NUMWORDS || format->decodeTable[instr].opIndex == INVALIDOP) {
+		memcpy(text, "dw 0x", 5);						// not an instruction: print it as a data word
+		text = putHex(text+5, instr, 4);
+		*text++ = '\n';
+		return text;
+	}
+
+	entry = &format->decodeTable[instr];				// one indexed load gives instruction and operands
+	name = &format->mnemonic[entry->opIndex];
+	memcpy(text, name->text, MNEMONICSIZE);				// fixed size: a couple of moves, extra bytes are overwritten
+	text += name->length;
+	if (entry->numOperands == 0)
+		return text;
+	text = putOperand(text, entry->operand[0], format->style);
+	if (entry->numOperands == 2) {
+		*text++ = ',';
+		text = putOperand(text, entry->operand[1], format->style);
+	}
+	*text++ = '\n';
+	return text;
+}
+
+
+int reserveText(struct textBuffer *output, size_t length) {	// makes room for length more bytes
+	char *bigger;
+	size_t capacity;
+
+	if (output->length + length > output->capacity) {	// capacity doubles, so appends cost O(1) amortized
+		capacity = (output->capacity == 0) ? 65536 : 2*output->capacity;
+		while (capacity < output->length + length)
+			capacity *= 2;
+		if ((bigger = (char *)realloc(output->text, capacity)) == NULL) {
+			output->error = 1;
+			return 1;
+		}
+		output->text = bigger;
+		output->capacity = capacity;
+	}
+	return 0;
+}
+
+
+int appendText(struct textBuffer *output, const char *text, size_t length) {
+	if (reserveText(output, length) != 0)
+		return 1;
+	memcpy(output->text + output->length, text, length);
+	output->length += length;
+	return 0;
+}
+
+
+static struct wordPage *wordPageFor(struct wordImage *image, unsigned long number) {
+	// page number of image, added (empty) if it is not there; NULL if there is no memory
+	struct wordPage *page, **bigger;
+	int low = 0, high = image->numPages, middle, capacity;
+
+	if (image->last < image->numPages && image->page[image->last]->number == number)
+		return image->page[image->last];
+	if (high > 0 && image->page[high-1]->number < number)
+		low = high;							// records in order of address only add pages at the end
+	while (low < high) {					// binary search of the first page not before number
+		middle = (low + high) / 2;
+		if (image->page[middle]->number < number)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	if (low < image->numPages && image->page[low]->number == number) {
+		image->last = low;
+		return image->page[low];
+	}
+	if (image->numPages == image->capacity) {
+		capacity = (image->capacity == 0) ? 16 : 2*image->capacity;
+		if ((bigger = (struct wordPage **)realloc(image->page, capacity*sizeof(struct wordPage *))) == NULL)
+			return NULL;
+		image->page = bigger;
+		image->capacity = capacity;
+	}
+	if ((page = (struct wordPage *)calloc(1, sizeof(struct wordPage))) == NULL)
+		return NULL;
+	page->number = number;
+	memmove(image->page + low + 1, image->page + low, (image->numPages - low)*sizeof(struct wordPage *));
+	image->page[low] = page;
+	image->numPages++;
+	image->last = low;
+	return page;
+}
+
+
+int readHexWords(const char *hex, size_t size, struct wordImage *image, struct recordError **errors, int *numErrors) {
+	// puts the data bytes of every record at their address in image (low byte of a word first)
+	struct hexRecord record;
+	struct recordError *bigger;
+	struct wordPage *page;
+	const char *line, *lineEnd, *end = hex + size;
+	unsigned long baseAddress = 0, address;
+	int i, bit, length, code, numLines = 0, maxErrors = 0;
+
+	*errors = NULL;
+	*numErrors = 0;
+	for (line = hex; line < end; line = lineEnd + 1) {
+		numLines++;
+		lineEnd = memchr(line, '\n', end - line);
+		if (lineEnd == NULL)
+			lineEnd = end;
+		length = lineEnd - line;
+		while (length > 0 && (line[length-1] == '\r' || line[length-1] == ' ' || line[length-1] == '\t'))
+			length--;
+		while (length > 0 && (*line == ' ' || *line == '\t')) {
+			line++;
+			length--;
+		}
+		if (length == 0)
+			continue;
+		if ((code = parseRecord(line, length, &record)) != 0) {
+			if (*numErrors == maxErrors) {
+				maxErrors = (maxErrors == 0) ? 16 : 2*maxErrors;
+				if ((bigger = (struct recordError *)realloc(*errors, maxErrors*sizeof(struct recordError))) == NULL)
+					return 17;
+				*errors = bigger;
+			}
+			(*errors)[*numErrors].line = numLines;
+			(*errors)[(*numErrors)++].code = code;
+			continue;
+		}
+		if (record.type == 4)
+			baseAddress = ((unsigned long)record.byte[4]<<24) | ((unsigned long)record.byte[5]<<16);
+		else if (record.type == 2)
+			baseAddress = (((unsigned long)record.byte[4]<<8) | record.byte[5]) << 4;
+		if (record.type != 0 || record.dataLength == 0)
+			continue;
+		address = baseAddress + record.address;
+		for (i=0; i<record.dataLength; i++, address++) {
+			if ((page = wordPageFor(image, address/2/WORDPAGEWORDS)) == NULL)
+				return 17;
+			bit = (address/2) % WORDPAGEWORDS;
+			page->word[bit] = (address & 1) ? (page->word[bit] & 0xff) | (record.byte[4+i] << 8)
+					: (page->word[bit] & 0xff00) | record.byte[4+i];
+			if (!((page->present[bit/64] >> (bit%64)) & 1)) {
+				page->present[bit/64] |= 1ULL << (bit%64);
+				image->numWords++;
+			}
+		}
+	}
+	return (*numErrors > 0) ? 20 : 0;
+}
+
+
+int findImagePage(const struct wordImage *image, unsigned long number, int hint) {
+	// index of page number in image, -1 if it is not there; page hint is looked at first
+	int low = 0, high = image->numPages, middle;
+
+	if (hint >= 0 && hint < image->numPages && image->page[hint]->number == number)
+		return hint;
+	while (low < high) {					// binary search of the first page not before number
+		middle = (low + high) / 2;
+		if (image->page[middle]->number < number)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return (low < image->numPages && image->page[low]->number == number) ? low : -1;
+}
+
+
+int findImageWord(const struct wordImage *image, unsigned long address) {	// the word at address, -1 if there is none
+	int i = findImagePage(image, address/WORDPAGEWORDS, image->last), bit = address % WORDPAGEWORDS;
+
+	if (i < 0 || !((image->page[i]->present[bit/64] >> (bit%64)) & 1))
+		return -1;
+	return image->page[i]->word[bit];
+}
+
+
+void freeWordImage(struct wordImage *image) {
+	int i;
+
+	for (i=0; i<image->numPages; i++)
+		free(image->page[i]);
+	free(image->page);
+	memset(image, 0, sizeof(struct wordImage));
+}
+
+
+static char *putAddress(char *text, unsigned long address) {	// at least 4 hex digits; stores 4 bytes more
+	if (address > 0xffff)
+		text = putHex(text, address >> 16, 1 + (address >= 0x100000) + (address >= 0x1000000) + (address >= 0x10000000));
+	return putHex(text, address & 0xffff, 4);
+}
+
+
+static char *putOrg(char *text, unsigned long address) {	// "org 0x....\n"
+	memcpy(text, "org 0x", 6);
+	text = putAddress(text+6, address);
+	*text++ = '\n';
+	return text;
+}
+
+
+static char *putData(char *text, unsigned long address, unsigned int word) {
+	// "__config 0x....\n" for the configuration word, "de 0x..\n" for a byte of data EEPROM, NULL for other words
+	if (address == CONFIGADDRESS && word <= MAXCONFIG) {
+		memcpy(text, "__config 0x", 11);
+		text = putHex(text+11, word, 4);
+	}
+	else if (address - EEPROMADDRESS < EEPROMWORDS && word <= 0xff) {
+		memcpy(text, "de 0x", 5);
+		text = putHex(text+5, word, 2);
+	}
+	else
+		return NULL;
+	*text++ = '\n';
+	return text;
+}
+
+
+static char *putLabel(char *text, unsigned long address, int isCalled) {
+	*text++ = isCalled ? 'f' : 'l';
+	*text++ = '_';
+	return putAddress(text, address);
+}
+
+
+static long findPosition(const struct wordImage *image, unsigned long address, int hint) {
+	// position of address in the pages of image (page index*WORDPAGEWORDS + offset), -1 if its page is missing
+	int i = findImagePage(image, address/WORDPAGEWORDS, hint);
+
+	return (i < 0) ? -1 : (long)i*WORDPAGEWORDS + address%WORDPAGEWORDS;
+}
+
+
+int disassembleLabelled(const struct instructionSet *set, const struct wordImage *image, int style, struct textBuffer *output,
+		struct textBuffer *graph) {
+	static const char *flowName[] = {"goto", "call", "return", "retlw", "retfie", "btfsc", "btfss", "decfsz", "incfsz"};
+	static const unsigned char flowKind[] = {FLOWGOTO, FLOWCALL, FLOWRETURN, FLOWRETURN, FLOWRETURN, FLOWSKIP, FLOWSKIP, FLOWSKIP, FLOWSKIP};
+	unsigned char flow[INVALIDOP];			// kind of each instruction of set
+	struct format format;
+	const struct decodeEntry *entry;
+	const struct instruction *instr;
+	const struct wordPage *page;
+	unsigned long long *leader, *target, *called;	// bitmaps of the first pass, by position
+	unsigned long *caller = NULL;			// caller[position]: function that made the last edge to it, plus 1
+	size_t numBlocks = (size_t)image->numPages*WORDPAGEWORDS/64;
+	unsigned long a, t, next = 0, function = 0;	// function: address of the current called address plus 1, 0 for reset
+	long p, s;								// positions of a and of a successor or target
+	unsigned int word;
+	char *text, *data;
+	int i, j, o, kind;
+
+	setupFormat(&format, set, style);
+	memset(flow, FLOWNEXT, sizeof(flow));
+	for (i=0; i<set->numInstructions && i<INVALIDOP; i++)
+		for (j=0; j<(int)(sizeof(flowName)/sizeof(flowName[0])); j++)
+			if (strncmp(set->instr[i].name, flowName[j], sizeof(set->instr[i].name)) == 0)
+				flow[i] = flowKind[j];
+	if ((leader = (unsigned long long *)calloc(3*numBlocks + 1, sizeof(unsigned long long))) == NULL
+			|| (graph != NULL && (caller = (unsigned long *)calloc(64*numBlocks + 1, sizeof(unsigned long))) == NULL)) {
+		free(leader);
+		return 17;
+	}
+	target = leader + numBlocks;
+	called = target + numBlocks;
+
+
+	/************		first pass: targets and basic blocks		***************/
+	for (i=0; i<image->numPages; i++) {
+		page = image->page[i];
+		for (o=0; o<WORDPAGEWORDS; o++) {
+			if (page->present[o/64] == 0) {	// 64 missing addresses at once
+				o |= 63;
+				continue;
+			}
+			if (!((page->present[o/64] >> (o%64)) & 1) || page->word[o] >= NUMWORDS
+					|| format.decodeTable[page->word[o]].opIndex == INVALIDOP)
+				continue;
+			entry = &format.decodeTable[page->word[o]];
+			kind = flow[entry->opIndex];
+			if (kind == FLOWNEXT)
+				continue;
+			a = page->number*WORDPAGEWORDS + o;
+			if ((s = findPosition(image, a+1, i)) >= 0)	// a word after a branch starts a block (a successor only after a skip)
+				leader[s/64] |= 1ULL << (s%64);
+			if (kind == FLOWSKIP && (s = findPosition(image, a+2, i)) >= 0)
+				leader[s/64] |= 1ULL << (s%64);
+			if (kind == FLOWGOTO || kind == FLOWCALL) {
+				t = (a & ~0x7ffUL) | entry->operand[0];
+				if ((s = findPosition(image, t, i)) >= 0
+						&& ((image->page[s/WORDPAGEWORDS]->present[s%WORDPAGEWORDS/64] >> (s%64)) & 1)) {
+					leader[s/64] |= 1ULL << (s%64);
+					target[s/64] |= 1ULL << (s%64);
+					if (kind == FLOWCALL)
+						called[s/64] |= 1ULL << (s%64);
+				}
+			}
+		}
+	}
+
+
+	/************		second pass: text		***************/
+	if (graph != NULL && appendText(graph, "digraph calls {\n\treset;\n", 24) != 0)
+		goto noMemory;
+	for (i=0; i<image->numPages; i++) {
+		page = image->page[i];
+		for (o=0; o<WORDPAGEWORDS; o++) {
+			if (page->present[o/64] == 0) {
+				o |= 63;
+				continue;
+			}
+			if (!((page->present[o/64] >> (o%64)) & 1))
+				continue;
+			if (reserveText(output, 3*MAXLINE) != 0)
+				goto noMemory;
+			a = page->number*WORDPAGEWORDS + o;
+			p = (long)i*WORDPAGEWORDS + o;
+			word = page->word[o];
+			text = output->text + output->length;
+			if (a == CONFIGADDRESS && word <= MAXCONFIG && !((target[p/64] >> (p%64)) & 1)) {
+				if (output->length > 0)		// __config doesn't move the address: next stays as it is
+					*text++ = '\n';
+				output->length = putData(text, a, word) - output->text;
+				continue;
+			}
+			if (a != next) {				// addresses missing before this one
+				if (output->length > 0)
+					*text++ = '\n';
+				text = putOrg(text, a);
+			}
+			else if (a > 0 && ((leader[p/64] >> (p%64)) & 1))
+				*text++ = '\n';
+			next = a+1;
+			if ((target[p/64] >> (p%64)) & 1) {
+				text = putLabel(text, a, (called[p/64] >> (p%64)) & 1);
+				*text++ = ':';
+				*text++ = '\n';
+				if (graph != NULL && ((called[p/64] >> (p%64)) & 1)) {
+					function = a+1;
+					output->length = text - output->text;	// the text so far is kept while graph grows
+					if (reserveText(graph, MAXLINE) != 0)
+						goto noMemory;
+					text = graph->text + graph->length;
+					*text++ = '\t';
+					text = putLabel(text, a, 1);
+					*text++ = ';';
+					*text++ = '\n';
+					graph->length = text - graph->text;
+					text = output->text + output->length;
+				}
+			}
+
+			entry = (word < NUMWORDS) ? &format.decodeTable[word] : NULL;
+			if (entry != NULL && entry->opIndex != INVALIDOP) {
+				instr = &set->instr[entry->opIndex];
+				t = (unsigned int)instr->opCode << instr->shiftOpCode;	// word the assembler makes of this text
+				for (j=0; j<entry->numOperands; j++)
+					t |= (unsigned long)entry->operand[j] << instr->shiftOperand[j];
+				if (t != word)
+					entry = NULL;			// don't-care bits are set: only dw gives it back
+			}
+			if (a != CONFIGADDRESS && (data = putData(text, a, word)) != NULL)	// de (a target at CONFIGADDRESS gets dw)
+				text = data;
+			else if (entry == NULL && word < NUMWORDS) {
+				memcpy(text, "dw 0x", 5);
+				text = putHex(text+5, word, 4);
+				*text++ = '\n';
+			}
+			else if (entry != NULL && (flow[entry->opIndex] == FLOWGOTO || flow[entry->opIndex] == FLOWCALL)
+					&& (s = findPosition(image, t = (a & ~0x7ffUL) | entry->operand[0], i)) >= 0
+					&& ((target[s/64] >> (s%64)) & 1)) {
+				memcpy(text, format.mnemonic[entry->opIndex].text, MNEMONICSIZE);
+				text = putLabel(text + format.mnemonic[entry->opIndex].length, t, (called[s/64] >> (s%64)) & 1);
+				*text++ = '\n';
+				if (graph != NULL && flow[entry->opIndex] == FLOWCALL && caller[s] != function+1) {
+					caller[s] = function+1;	// functions are contiguous: an edge is written once per pair
+					output->length = text - output->text;
+					if (reserveText(graph, 2*MAXLINE) != 0)
+						goto noMemory;
+					text = graph->text + graph->length;
+					*text++ = '\t';
+					if (function == 0) {
+						memcpy(text, "reset", 5);
+						text += 5;
+					}
+					else
+						text = putLabel(text, function-1, 1);
+					memcpy(text, " -> ", 4);
+					text = putLabel(text+4, t, 1);
+					*text++ = ';';
+					*text++ = '\n';
+					graph->length = text - graph->text;
+					text = output->text + output->length;
+				}
+			}
+			else
+				text = formatInstr(text, word, &format);
+			output->length = text - output->text;
+		}
+	}
+	if (graph != NULL && appendText(graph, "}\n", 2) != 0)
+		goto noMemory;
+	free(leader);
+	free(caller);
+	return output->error ? 17 : 0;
+
+noMemory:
+	free(leader);
+	free(caller);
+	return 17;
+}
+
+
+void *disassemblyWorker(void *arg) {
+	struct disassembly *job = (struct disassembly *)arg;
+	int next;
+
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		next = job->nextChunk++;
+		pthread_mutex_unlock(&job->lock);
+		if (next >= job->numChunks)
+			return NULL;
+		disassembleChunk(&job->chunks[next], &job->format, job->timePhases ? &job->chunks[next].phases : NULL);
+	}
+}
+
+
+static void putWords(struct chunk *chunk, const unsigned int *words, int count, unsigned long address, const struct format *format) {
+	// appends the lines of count words from address on, after an org if they don't follow the words before
+	char *text, *data;
+	int i;
+
+	if (count == 0)
+		return;
+	if (!chunk->addressKnown) {			// the merge writes the org in front of the chunk if it is needed
+		chunk->addressKnown = 1;
+		chunk->firstAddress = address;
+		chunk->next = address;
+	}
+	if (address == chunk->next && address + count <= CONFIGADDRESS) {	// almost always: code in sequence
+		formatWords(words, count, format, &chunk->output);
+		chunk->next += count;
+		return;
+	}
+	if (reserveText(&chunk->output, (size_t)count*2*MAXLINE) != 0)
+		return;
+	text = chunk->output.text + chunk->output.length;
+	for (i=0; i<count; i++, address++) {
+		if (address == CONFIGADDRESS && words[i] <= MAXCONFIG) {	// __config doesn't move the address
+			text = putData(text, address, words[i]);
+			continue;
+		}
+		if (address != chunk->next)
+			text = putOrg(text, address);
+		text = ((data = putData(text, address, words[i])) != NULL) ? data : formatInstr(text, words[i], format);
+		chunk->next = address+1;
+	}
+	chunk->output.length = text - chunk->output.text;
+}
+
+
+static inline void addWord(struct chunk *chunk, unsigned int *words, int *numWords, unsigned long *first, unsigned int word,
+		unsigned long address, const struct format *format) {
+	// adds word at address to words, putting the words before it first if it doesn't follow them
+	if (*numWords > 0 && address != *first + *numWords) {
+		putWords(chunk, words, *numWords, *first, format);
+		*numWords = 0;
+	}
+	if (*numWords == 0)
+		*first = address;
+	words[(*numWords)++] = word;
+}
+
+
+void disassembleChunk(struct chunk *chunk, const struct format *format, struct phaseTimer *phases) {
+	// phases, if not NULL, gets the time of 1 record in SAMPLEEVERY and of every write
+	struct hexRecord record;		// record being examined
+	struct recordError *errors;
+	const char *line, *lineEnd;		// first and one past last character of current record
+	int i, length, code;
+	unsigned int words[MAXRECORDLENGTH];	// words of a data record, formatted after the record is decoded
+	int numWords;
+	unsigned long wordAddress = 0;	// address of words[0]
+	unsigned long long tick = 0;
+	int timed = 0;					// 1 if the current record is one of the samples
+	unsigned long baseAddress = chunk->baseAddress;	// address set by extended address records
+	unsigned long address;			// address of current data byte
+	int pendingByte = -1;			// low byte of a word whose high byte is in next record, -1 if none
+	unsigned long pendingAddress = 0;
+
+	for (line = chunk->start; line < chunk->end; line = lineEnd + 1) {	// examine one record per line
+		chunk->numLines++;
+		lineEnd = memchr(line, '\n', chunk->end - line);
+		if (lineEnd == NULL)
+			lineEnd = chunk->end;
+		length = lineEnd - line;
+		while (length > 0 && (line[length-1] == '\r' || line[length-1] == ' ' || line[length-1] == '\t'))
+			length--;									// ignore trailing blanks and Windows line ends
+		while (length > 0 && (*line == ' ' || *line == '\t')) {
+			line++;
+			length--;
+		}
+		if (length == 0)
+			continue;									// empty line
+
+		if (phases != NULL && (timed = ((phases->events[DISPARSE]++ & (SAMPLEEVERY-1)) == 0)))
+			tick = readTicks();
+		code = parseRecord(line, length, &record);
+		if (timed)
+			tick = lapPhase(phases, DISPARSE, tick);
+		if (code != 0) {
+			if (chunk->numErrors == chunk->maxErrors) {
+				chunk->maxErrors = (chunk->maxErrors == 0) ? 16 : 2*chunk->maxErrors;
+				if ((errors = (struct recordError *)realloc(chunk->errors, chunk->maxErrors*sizeof(struct recordError))) == NULL) {
+					chunk->output.error = 1;			// the error can't be recorded: the whole result is out of memory
+					chunk->maxErrors = chunk->numErrors;
+					continue;
+				}
+				chunk->errors = errors;
+			}
+			chunk->errors[chunk->numErrors].line = chunk->numLines;
+			chunk->errors[chunk->numErrors].code = code;
+			chunk->numErrors++;
+			continue;
+		}
+
+		if (record.type == 1) {							// dataType equal to 01 corresponds to END
+			words[0] = pendingByte;
+			if (pendingByte >= 0)						// a word without high byte
+				putWords(chunk, words, 1, pendingAddress/2, format);
+			pendingByte = -1;
+			appendText(&chunk->output, "END\n", 4);
+		}
+		else if (record.type == 4)						// extended linear address: upper 16 bits of address
+			baseAddress = ((unsigned long)record.byte[4]<<24) | ((unsigned long)record.byte[5]<<16);
+		else if (record.type == 2)						// extended segment address: segment * 16
+			baseAddress = (((unsigned long)record.byte[4]<<8) | record.byte[5]) << 4;
+		else if (record.type == 0) {					// dataType equal to 00 corresponds to data
+			address = baseAddress + record.address;
+			numWords = 0;
+			for (i=0; i<record.dataLength; i++, address++) {	// each word is made of 2 bytes, low byte first
+				if ((address & 1) == 0) {				// low byte: wait for high byte
+					if (pendingByte >= 0)
+						addWord(chunk, words, &numWords, &wordAddress, pendingByte, pendingAddress/2, format);
+					pendingByte = record.byte[4+i];
+					pendingAddress = address;
+				}
+				else if (pendingByte >= 0 && pendingAddress+1 == address) {
+					addWord(chunk, words, &numWords, &wordAddress, pendingByte | (record.byte[4+i]<<8), address/2, format);
+					pendingByte = -1;
+				}
+				else {									// high byte without its low byte
+					if (pendingByte >= 0)
+						addWord(chunk, words, &numWords, &wordAddress, pendingByte, pendingAddress/2, format);
+					pendingByte = -1;
+					addWord(chunk, words, &numWords, &wordAddress, record.byte[4+i]<<8, address/2, format);
+				}
+			}
+			if (phases != NULL) {
+				phases->events[DISDECODE]++;
+				if (timed)
+					tick = lapPhase(phases, DISDECODE, tick);
+			}
+			putWords(chunk, words, numWords, wordAddress, format);
+			if (phases != NULL) {
+				phases->events[DISFORMAT]++;
+				if (timed)
+					lapPhase(phases, DISFORMAT, tick);
+			}
+		}
+		if (chunk->sink != NULL && chunk->output.length >= FLUSHTEXT) {
+			if (phases != NULL)
+				tick = readTicks();
+			if (fwrite(chunk->output.text, 1, chunk->output.length, chunk->sink) != chunk->output.length)
+				chunk->writeError = 1;
+			chunk->output.length = 0;
+			if (phases != NULL) {
+				phases->events[DISWRITE]++;
+				lapPhase(phases, DISWRITE, tick);
+			}
+		}
+	}
+	words[0] = pendingByte;
+	if (pendingByte >= 0)
+		putWords(chunk, words, 1, pendingAddress/2, format);
+}
+
+
+int splitChunks(const char *data, size_t size, int numThreads, struct chunk **chunks) {
+	// splits data in chunks of about the same size, returns how many chunks were made (-1 if there is no memory)
+	const char *end = data + size;
+	const char *cut, *start = data, *line;
+	struct hexRecord record;
+	unsigned long baseAddress = 0;
+	size_t chunkSize;
+	int length, numChunks = 0, maxChunks;
+
+	maxChunks = (numThreads > 1) ? numThreads*CHUNKSPERTHREAD : 1;
+	chunkSize = size/maxChunks;
+	if (chunkSize < MINCHUNK)
+		chunkSize = MINCHUNK;
+	if ((*chunks = (struct chunk *)calloc(maxChunks, sizeof(struct chunk))) == NULL)
+		return -1;
+
+	while (start < end) {
+		cut = end;
+		if (numChunks < maxChunks-1 && (size_t)(end - start) > chunkSize) {
+			cut = nextLine(start + chunkSize, end);	// first line after the wanted size...
+			while (cut < end && !canSplitAfter(start, cut))
+				cut = nextLine(cut, end);			// ...that follows a record after which no word is pending
+		}
+		(*chunks)[numChunks].start = start;
+		(*chunks)[numChunks].end = cut;
+		(*chunks)[numChunks].baseAddress = baseAddress;
+		(*chunks)[numChunks].addressKnown = (numChunks == 0);
+		numChunks++;
+		for (line = start; cut < end && line < cut; line = nextLine(line, cut)) {	// extended address records of the chunk
+			while (line < cut && (*line == ' ' || *line == '\t'))
+				line++;
+			if (cut - line < 11 || line[7] != '0' || (line[8] != '4' && line[8] != '2'))
+				continue;							// quick test of the type, before the whole record is checked
+			length = nextLine(line, cut) - line;
+			while (length > 0 && (line[length-1] == '\n' || line[length-1] == '\r' || line[length-1] == ' ' || line[length-1] == '\t'))
+				length--;
+			if (parseRecord(line, length, &record) != 0)
+				continue;
+			if (record.type == 4)
+				baseAddress = ((unsigned long)record.byte[4]<<24) | ((unsigned long)record.byte[5]<<16);
+			else if (record.type == 2)
+				baseAddress = (((unsigned long)record.byte[4]<<8) | record.byte[5]) << 4;
+		}
+		start = cut;
+	}
+	return numChunks;
+}
+
+
+const char *nextLine(const char *from, const char *end) {	// start of the line after the one containing from
+	const char *newLine = memchr(from, '\n', end - from);
+	return (newLine == NULL) ? end : newLine + 1;
+}
+
+
+int canSplitAfter(const char *chunkStart, const char *lineStart) {
+	// 1 if the line before lineStart is a valid data record ending at an even address, so the next record starts a new word
+	struct hexRecord record;
+	const char *line = lineStart - 1;			// '\n' of previous line
+	int length;
+
+	while (line > chunkStart && line[-1] != '\n')
+		line--;
+	length = lineStart - 1 - line;
+	while (length > 0 && (line[length-1] == '\r' || line[length-1] == ' ' || line[length-1] == '\t'))
+		length--;
+	while (length > 0 && (*line == ' ' || *line == '\t')) {
+		line++;
+		length--;
+	}
+	if (length == 0 || parseRecord(line, length, &record) != 0)
+		return 0;
+	return record.type == 0 && ((record.address + record.dataLength) & 1) == 0;
+}
+
+
+int parseRecord(const char *text, int length, struct hexRecord *record) {
+	// returns 0 if record is valid, 1 if it is malformed, 2 if it has non hex characters, 3 if its length is wrong, 4 if checksum is wrong
+	int numBytes = (length-1)/2;
+	unsigned int sum;
+
+	if (text[0] != ':' || (length-1) % 2 != 0 || numBytes < 5 || numBytes > MAXRECORDLENGTH)
+		return 1;
+	if (decodeHex(text+1, numBytes, record->byte, &sum) != 0)	// whole record converted, and summed, in one pass
+		return 2;
+	if (record->byte[0] != numBytes-5)
+		return 3;
+	if ((sum & 0xff) != 0)						// all bytes, checksum included, must sum to 0
+		return 4;
+	record->dataLength = record->byte[0];
+	record->address = (record->byte[1]<<8) | record->byte[2];
+	record->type = record->byte[3];
+	return 0;
+}
+
+
+int decodeHex(const char *text, int numBytes, unsigned char *bytes, unsigned int *sum) {
+	// converts 2*numBytes hex characters into numBytes bytes and sums them; returns 1 if a character is not a hex digit
+	int i = 0, high, low;
+	unsigned int total = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	__m128i total128 = zero;
+	__m128i c, lower, isDigit, isLetter, value, packed;
+
+	for (; i+8 <= numBytes; i += 8) {			// 16 characters => 8 bytes per iteration
+		c = _mm_loadu_si128((const __m128i *)(text + 2*i));
+		lower = _mm_or_si128(c, _mm_set1_epi8(0x20));	// 'A'-'F' => 'a'-'f'
+		isDigit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0'-1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9'+1)));
+		isLetter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a'-1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f'+1)));
+		if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xffff)
+			return 1;
+		value = _mm_or_si128(_mm_and_si128(isDigit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+				_mm_and_si128(isLetter, _mm_sub_epi8(lower, _mm_set1_epi8('a'-10))));
+		// each 16-bit lane holds high nibble in its low byte and low nibble in its high byte
+		packed = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(value, _mm_set1_epi16(0x00ff)), 4), _mm_srli_epi16(value, 8));
+		packed = _mm_packus_epi16(packed, zero);
+		_mm_storel_epi64((__m128i *)(bytes + i), packed);
+		total128 = _mm_add_epi64(total128, _mm_sad_epu8(packed, zero));	// checksum computed on the same registers
+	}
+	total = _mm_cvtsi128_si32(total128);
+#endif
+
+	for (; i<numBytes; i++) {					// remaining bytes (or all of them without SSE2)
+		high = text[2*i];
+		low = text[2*i+1];
+		if (high >= '0' && high <= '9')			high -= '0';
+		else if (high >= 'a' && high <= 'f')	high -= 'a' - 10;
+		else if (high >= 'A' && high <= 'F')	high -= 'A' - 10;
+		else return 1;
+		if (low >= '0' && low <= '9')			low -= '0';
+		else if (low >= 'a' && low <= 'f')		low -= 'a' - 10;
+		else if (low >= 'A' && low <= 'F')		low -= 'A' - 10;
+		else return 1;
+		bytes[i] = (high<<4) | low;
+		total += bytes[i];
+	}
+	*sum = total;
+	return 0;
+}
+
@@ -0,0 +1,176 @@
+/*
+
+Disassembler library: Intel hex text or words in memory => assembly text in memory.
+
+	Nothing here opens files or uses global data: the instructionSet (see isa.h, loaded with its decode table) is only
+	read, so any number of threads can disassemble at the same time. The disassembler program is built on top of these
+	functions.
+
+	/// API ///
+	disassembleWords(set, words, count, style, &text)
+		appends to text (a textBuffer, initialized to zeros by the caller and freed with free(text.text)) one line
+		per word: "name .op1,.op2", or "dw 0x...." for words that are not instructions. With style OPERANDHEX
+		operands are written "0x..", as the assembler also accepts them: "name 0xop1,0xop2".
+	disassembleHex(set, hex, size, numThreads, style, sink, &text, &errors, &numErrors, phases)
+		disassembles the size bytes of hex, a whole Intel hex file, with numThreads threads (0: number of cores).
+		The text is appended to text, or written to sink if it is not NULL (then text can be NULL). Corrupted records
+		are skipped and returned in errors (malloc'ed, to be freed), with their line; recordErrorText(code) describes them.
+		If phases is not NULL, the time of the phases DISPARSE...DISWRITE of all threads is added to it (see stats.h).
+		The text assembles back to the same addresses: "org 0x...." where the address jumps, "__config 0x...." for the
+		word at CONFIGADDRESS and "de 0x.." for bytes of data EEPROM (EEPROMWORDS words from EEPROMADDRESS).
+	Both return 0, 17 if there is no memory; disassembleHex returns 18 if some text couldn't be written to sink (the
+	caller still has to check fclose, for what stdio kept in its buffer) and 20 if some records were corrupted.
+	readHexWords(hex, size, &image, &errors, &numErrors) / disassembleLabelled(set, &image, style, &text, &graph)
+		labelled disassembly, see below. readHexWords puts the words of a whole Intel hex file in image (a wordImage
+		initialized to zeros, freed with freeWordImage) by address; it returns 0, 17 or 20 like disassembleHex.
+		Only pages of WORDPAGEWORDS words that hold something are kept, in order of address, so memory is
+		proportional to the words of the file and not to their addresses; findImageWord(image, address) gives the
+		word at address, -1 if the file has none.
+		disassembleLabelled appends the program to text and, if graph is not NULL, its call graph in DOT; it returns
+		0, or 17 if there is no memory.
+
+	/// LABELS ///
+	The labelled disassembly works on the pages of the image and takes two passes, both O(words in the pages); its
+	bitsets are indexed by position in the pages (page index*WORDPAGEWORDS + offset), not by address. The passes:
+	the first marks in bitsets the targets of goto and call (in the same 2K page, as the PIC sees them without
+	PCLATH) and the first instruction of each basic block (targets, the words after goto, return, retlw, retfie and
+	the two successors of btfsc, btfss, decfsz, incfsz); the second writes the text, with a label before each target
+	(f_xxxx if it is called, l_xxxx otherwise), goto/call using it, an empty line before each basic block and
+	"org 0x...." after addresses missing from the file; __config and de are used as by disassembleHex. Words that are not instructions, or that the assembler would
+	not give back as they are (don't-care bits set), are written as dw, so the text assembles to the same words.
+	The call graph has a node for each called address and one (reset) for the code before the first of them; code is
+	assumed to belong to the last called address before it, so each call is an edge from that node to its target.
+
+	/// TEXT ///
+	Lines are not made with printf: names are copied from a table of mnemonics (made once per call, with their
+	lengths and the space after them), operands are converted by putDecimal/putHex, which find the number of digits
+	with comparisons instead of a loop and store all digits at once. Space for the lines of a whole record is
+	reserved once, then lines are written without any check.
+
+	Build: compile dislib.c and isa.c with the program that uses them, with -pthread.
+
+*/
+
+#ifndef DISLIB_H
+#define DISLIB_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "isa.h"
+#include "stats.h"
+
+#define MAXRECORDLENGTH (5+255)		// length, address (2), type, up to 255 data bytes, checksum
+#define DISREAD 0					// phases of the disassembler: hex file read by the program (not by disassembleHex)
+#define DISPARSE 1					// hex characters of a record converted to bytes and checked
+#define DISDECODE 2					// data bytes of a record paired into words
+#define DISFORMAT 3					// text of the words of a record
+#define DISWRITE 4					// text written to sink
+#define NUMDISPHASES 5
+#define OPERANDDECIMAL 0			// style of operands: .12
+#define OPERANDHEX 1				// style of operands: 0xc
+#define MNEMONICSIZE 16				// bytes copied for each name, name and space included
+#define MAXLINE 48					// longest line ever written ("name .op1,.op2\n") plus room for the 8-byte stores
+#define CONFIGADDRESS 0x2007	// word address of the configuration word in hex files (as in asmlib.h)
+#define MAXCONFIG 0x3fff			// largest configuration word __config takes
+#define EEPROMADDRESS 0x2100		// word address of the data EEPROM in hex files, one byte per word
+#define EEPROMWORDS 128				// bytes of data EEPROM of the PIC16F627A
+#define WORDPAGEWORDS 256			// words of a page of wordImage, a multiple of 64
+#define FLOWNEXT 0					// kinds of instruction for the labelled disassembly: goes on to the next word
+#define FLOWGOTO 1
+#define FLOWCALL 2
+#define FLOWRETURN 3				// return, retlw, retfie: no successor in the same block
+#define FLOWSKIP 4					// btfsc, btfss, decfsz, incfsz: next word or the one after it
+
+struct hexRecord {				// one record of the hex file, converted to bytes
+	unsigned char byte[MAXRECORDLENGTH];	// all bytes of the record, from length to checksum
+	int dataLength;				// number of data bytes, data starts at byte[4]
+	unsigned int address;		// 16-bit address field
+	int type;					// 0 data, 1 end of file, 2 extended segment address, 4 extended linear address
+};
+
+struct mnemonic {				// name of an instruction as it is copied in the text
+	char text[MNEMONICSIZE];	// name followed by ' ' (or '\n' if it has no operands), padded with zeros
+	int length;					// characters of text used
+};
+
+struct format {					// everything needed to write the text of a word
+	const struct decodeEntry *decodeTable;
+	struct mnemonic mnemonic[INVALIDOP];	// indexed by opIndex
+	int style;					// OPERANDDECIMAL or OPERANDHEX
+};
+
+struct textBuffer {				// growing buffer of disassembled text
+	char *text;
+	size_t length;
+	size_t capacity;
+	int error;					// 1 if some text couldn't be stored
+};
+
+struct wordPage {				// WORDPAGEWORDS words starting at address number*WORDPAGEWORDS
+	unsigned long number;
+	unsigned long long present[WORDPAGEWORDS/64];	// bitmap of the addresses found in the file
+	unsigned short word[WORDPAGEWORDS];	// 0 where nothing was found
+};
+
+struct wordImage {				// words of a hex file by address, for the labelled disassembly
+	struct wordPage **page;		// pages with at least one word, in order of address
+	int numPages;
+	int capacity;
+	int last;					// page of the last byte stored, looked at first
+	unsigned long numWords;		// addresses found
+};
+
+struct recordError {			// a corrupted record
+	int line;					// line of the record, starting from 1 (inside its chunk until chunks are merged)
+	int code;					// value returned by parseRecord
+};
+
+struct chunk {					// a piece of the hex file made of whole records
+	const char *start;
+	const char *end;
+	struct textBuffer output;	// disassembled text of the chunk
+	FILE *sink;					// if not NULL, output is written here every FLUSHTEXT bytes (used when there is one chunk)
+	int writeError;				// 1 if some text couldn't be written to sink
+	int numLines;
+	unsigned long baseAddress;	// set by the last extended address record before the chunk
+	int addressKnown;			// 1 once the address of the words is known (from the start for the first chunk)
+	unsigned long firstAddress;	// address of the first word of the chunk
+	unsigned long next;			// address the assembler would give the next word
+	struct recordError *errors;
+	int numErrors;
+	int maxErrors;
+	struct phaseTimer phases;	// used only if the disassembly is timed
+};
+
+struct disassembly {			// everything shared by the threads
+	struct format format;
+	struct chunk *chunks;
+	int numChunks;
+	int nextChunk;				// first chunk not taken yet, protected by lock
+	int timePhases;				// 1 if chunks time their phases
+	pthread_mutex_t lock;
+};
+
+int disassembleWords(const struct instructionSet*, const unsigned short*, size_t, int, struct textBuffer*);
+int disassembleHex(const struct instructionSet*, const char*, size_t, int, int, FILE*, struct textBuffer*, struct recordError**, int*, struct phaseTimer*);
+int readHexWords(const char*, size_t, struct wordImage*, struct recordError**, int*);
+int disassembleLabelled(const struct instructionSet*, const struct wordImage*, int, struct textBuffer*, struct textBuffer*);
+void freeWordImage(struct wordImage*);
+int findImageWord(const struct wordImage*, unsigned long);
+int findImagePage(const struct wordImage*, unsigned long, int);
+const char *recordErrorText(int);
+void setupFormat(struct format*, const struct instructionSet*, int);
+int formatWords(const unsigned int*, int, const struct format*, struct textBuffer*);
+char *formatInstr(char*, unsigned int, const struct format*);	// arguments are destination, instruction to disassemble and format
+int reserveText(struct textBuffer*, size_t);
+int appendText(struct textBuffer*, const char*, size_t);
+int parseRecord(const char*, int, struct hexRecord*);
+int decodeHex(const char*, int, unsigned char*, unsigned int*);
+int splitChunks(const char*, size_t, int, struct chunk**);
+const char *nextLine(const char*, const char*);
+int canSplitAfter(const char*, const char*);
+void disassembleChunk(struct chunk*, const struct format*, struct phaseTimer*);
+void *disassemblyWorker(void*);
+
+#endif
@@ -0,0 +1,435 @@
+/*
+
+Loading, indexing and compiling of instruction sets. See isa.h.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "isa.h"
+
+int parseInstructionSet(const char*, struct instructionSet*, int);
+int mapInstructionSet(const char*, struct instructionSet*, const struct stat*);
+int checkMappedSet(const struct instructionSet*);
+int checkInstructions(const struct instruction*, int);
+int hashTextFile(const char*, unsigned int*, long*);
+unsigned int hashBytes(const void*, size_t, unsigned int);
+
+
+int acquireInstruction(FILE* filePtr, struct instruction *instructionToSet)	{	// -> will be used instead of . to dereference the pointer and access it
+	// returns 0, or 1 if the line is incomplete or has more operands than the arrays hold (the rest is checked by checkInstructions)
+	if (fscanf(filePtr, "%d", &instructionToSet->numOperands) != 1	// first parameter in file is number of operands
+			|| instructionToSet->numOperands < 0 || instructionToSet->numOperands > 2)
+		return 1;
+	if (fscanf(filePtr, "%9s", instructionToSet->name) != 1)		// second parameter in file is name of instruction
+		return 1;
+	for (int i=0; i< instructionToSet->numOperands; i++) {
+		if (fscanf(filePtr, "%d", &instructionToSet->maskOperand[i]) != 1	// next parameters are masks and shifts relative to operands
+				|| fscanf(filePtr, "%d", &instructionToSet->shiftOperand[i]) != 1)
+			return 1;
+	}
+	if (fscanf(filePtr, "%d", &instructionToSet->opCode) != 1		// next parameter is opcode
+			|| fscanf(filePtr, "%d", &instructionToSet->shiftOpCode) != 1)	// last parameter is shift of opCode
+		return 1;
+	return 0;
+}
+
+
+unsigned int hashName(const char* name, int length) {		// FNV-1a hash of the first length characters of name
+	return hashBytes(name, length, 2166136261u);
+}
+
+
+unsigned int hashBytes(const void *data, size_t length, unsigned int hash) {	// FNV-1a, hash is the starting value
+	const unsigned char *byte = (const unsigned char *)data;
+	while (length-- > 0) {
+		hash ^= *byte++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+int buildOpcodeTable(struct opcodeTable *table, const struct instruction *instructionSet, int numInstructions) {
+	int i, pos;
+	unsigned int hash;
+
+	table->size = 16;
+	while (table->size < 4*numInstructions)	// keep the table at most 1/4 full, so almost every lookup ends at the first slot
+		table->size *= 2;
+	table->slot = (int *)malloc(table->size*sizeof(int));
+	table->slotHash = (unsigned int *)calloc(table->size, sizeof(unsigned int));
+	if (table->slot == NULL || table->slotHash == NULL)
+		return 1;
+	for (i=0; i<table->size; i++)
+		table->slot[i] = EMPTYSLOT;
+
+	for (i=0; i<numInstructions; i++) {
+		hash = hashName(instructionSet[i].name, strlen(instructionSet[i].name));
+		pos = hash & (table->size-1);
+		while (table->slot[pos] != EMPTYSLOT) {		// linear probing: go to next slot until a free one is found
+			if (table->slotHash[pos] == hash && strcmp(instructionSet[table->slot[pos]].name, instructionSet[i].name) == 0)
+				break;								// duplicated name: first definition in file wins, as with the old linear search
+			pos = (pos+1) & (table->size-1);
+		}
+		if (table->slot[pos] == EMPTYSLOT) {
+			table->slot[pos] = i;
+			table->slotHash[pos] = hash;
+		}
+	}
+	return 0;
+}
+
+
+int findInstruction(const struct opcodeTable *table, const struct instruction *instructionSet, const char *name, int length, struct lookupStats *stats) {
+	unsigned int hash = hashName(name, length);
+	int pos = hash & (table->size-1);
+	const char *slotName;
+
+	stats->lookups++;
+	while (table->slot[pos] != EMPTYSLOT) {
+		stats->probes++;
+		slotName = instructionSet[table->slot[pos]].name;
+		if (table->slotHash[pos] == hash && strncmp(slotName, name, length) == 0 && slotName[length] == '\0')
+			return table->slot[pos];				// instruction found in instructionSet at position returned
+		pos = (pos+1) & (table->size-1);
+	}
+	stats->probes++;								// the empty slot that ends the search is a probe as well
+	stats->misses++;
+	return -1;
+}
+
+
+int buildDecodeTable(struct decodeEntry *decodeTable, const struct instruction *instructionSet, int numInstructions) {
+	int word, i, j;
+	int fixedMask, fixedBits, bestFixedBits;
+
+	for (word=0; word<NUMWORDS; word++) {
+		decodeTable[word].opIndex = INVALIDOP;
+		decodeTable[word].numOperands = 0;
+		decodeTable[word].operand[0] = 0;
+		decodeTable[word].operand[1] = 0;
+		bestFixedBits = -1;
+
+		for (i=0; i<numInstructions; i++) {
+			fixedMask = (NUMWORDS-1) & ~((1<<instructionSet[i].shiftOpCode)-1);	// opCode fills bits from its shift up to bit 13
+			if ((word & fixedMask) != ((instructionSet[i].opCode<<instructionSet[i].shiftOpCode) & (NUMWORDS-1)))
+				continue;
+			fixedBits = WORDBITS - instructionSet[i].shiftOpCode;
+			if (fixedBits <= bestFixedBits)		// if more instructions match, the one with the longest opcode wins (ex: clrw vs nop)
+				continue;						// with equal length the first in the instruction set wins
+			bestFixedBits = fixedBits;
+
+			decodeTable[word].opIndex = i;
+			decodeTable[word].numOperands = instructionSet[i].numOperands;
+			for (j=0; j<instructionSet[i].numOperands; j++)
+				decodeTable[word].operand[j] = (word>>instructionSet[i].shiftOperand[j]) & ((1<<instructionSet[i].maskOperand[j])-1);
+		}
+	}
+	return 0;
+}
+
+
+int loadInstructionSet(const char *fileName, struct instructionSet *set, int wantDecodeTable) {
+	// fileName is the text file (its compiled file is used if up to date) or directly a compiled .bin file
+	// returns 1 if the file can't be read, 17 if there is no memory
+	struct stat textInfo, binaryInfo;
+	char *binaryName;
+	size_t length = strlen(fileName);
+	unsigned int hash;
+	long textSize;
+	int fresh;
+
+	if (length > 4 && strcmp(fileName + length - 4, ".bin") == 0)
+		return mapInstructionSet(fileName, set, NULL);
+
+	if ((binaryName = compiledNameFor(fileName)) == NULL)
+		return 17;
+	fresh = stat(fileName, &textInfo) == 0 && stat(binaryName, &binaryInfo) == 0
+			&& (binaryInfo.st_mtim.tv_sec > textInfo.st_mtim.tv_sec
+				|| (binaryInfo.st_mtim.tv_sec == textInfo.st_mtim.tv_sec && binaryInfo.st_mtim.tv_nsec >= textInfo.st_mtim.tv_nsec));
+	if (fresh && mapInstructionSet(binaryName, set, &textInfo) == 0) {
+		if (hashTextFile(fileName, &hash, &textSize) == 0 && hash == ((const struct isaFileHeader *)set->mapping)->sourceHash) {
+			free(binaryName);
+			return 0;
+		}
+		freeInstructionSet(set);				// compiled from another text of the same size
+	}
+	free(binaryName);
+	return parseInstructionSet(fileName, set, wantDecodeTable);	// no compiled file, or text file is newer
+}
+
+
+int parseInstructionSet(const char *fileName, struct instructionSet *set, int wantDecodeTable) {
+	FILE *filePtr;
+	struct instruction *instr;
+	int i, numInstructions, status;
+
+	if ((filePtr=fopen(fileName, "r"))==NULL)
+		return 1;
+	if (fscanf(filePtr, "%d", &numInstructions) != 1 || numInstructions <= 0 || numInstructions >= INVALIDOP) {	// first element in file is number of instructions contained
+		fclose(filePtr);
+		return 1;
+	}
+	if ((instr = (struct instruction *)calloc(numInstructions, sizeof(struct instruction))) == NULL) {
+		fclose(filePtr);
+		return 17;
+	}
+	for (i=0; i<numInstructions; i++) {
+		if (acquireInstruction(filePtr, &instr[i]) != 0) {	// call acquireInstruction to load the instruction in my struct.
+			fclose(filePtr);								// (instruction address is passed so I can modify it)
+			free(instr);
+			return 1;
+		}
+	}
+	fclose(filePtr);
+	if (checkInstructions(instr, numInstructions) != 0) {	// same checks as a mapped file, so isacompiler writes checked values
+		free(instr);
+		return 1;
+	}
+
+	status = setupInstructionSet(set, instr, numInstructions, wantDecodeTable);
+	free(instr);
+	return status;
+}
+
+
+int setupInstructionSet(struct instructionSet *set, const struct instruction *instr, int numInstructions, int wantDecodeTable) {
+	// builds set from an array of instructions (a parsed file or a table built in a program); instr is copied
+	memset(set, 0, sizeof(struct instructionSet));
+	set->numInstructions = numInstructions;
+	if ((set->instr = (struct instruction *)malloc(numInstructions*sizeof(struct instruction))) == NULL)
+		return 17;
+	memcpy(set->instr, instr, numInstructions*sizeof(struct instruction));
+
+	if (buildOpcodeTable(&set->opTable, set->instr, numInstructions) != 0) {	// index instruction names for O(1) lookup
+		freeInstructionSet(set);
+		return 17;
+	}
+	if (wantDecodeTable) {
+		if ((set->decodeTable = (struct decodeEntry *)malloc(NUMWORDS*sizeof(struct decodeEntry))) == NULL) {
+			freeInstructionSet(set);
+			return 17;
+		}
+		buildDecodeTable(set->decodeTable, set->instr, numInstructions);
+	}
+	return 0;
+}
+
+
+int mapInstructionSet(const char *binaryName, struct instructionSet *set, const struct stat *textInfo) {
+	// maps a compiled file; textInfo, if not NULL, is the text file it must have been compiled from
+	const struct isaFileHeader *header;
+	struct stat info;
+	char *base;
+	size_t expected;
+	int fd;
+
+	if ((fd = open(binaryName, O_RDONLY)) < 0)
+		return 1;
+	if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(struct isaFileHeader)) {
+		close(fd);
+		return 1;
+	}
+	base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return 1;
+
+	header = (const struct isaFileHeader *)base;
+	expected = sizeof(struct isaFileHeader) + header->numInstructions*sizeof(struct instruction)
+			+ header->tableSize*(sizeof(int) + sizeof(unsigned int)) + header->numWords*sizeof(struct decodeEntry);
+	if (memcmp(header->magic, ISAMAGIC, 8) != 0 || header->version != ISAVERSION
+			|| header->instructionSize != sizeof(struct instruction) || header->decodeEntrySize != sizeof(struct decodeEntry)
+			|| header->numWords != NUMWORDS || header->numInstructions == 0 || header->numInstructions >= INVALIDOP
+			|| (header->tableSize & (header->tableSize-1)) != 0 || header->tableSize < header->numInstructions
+			|| expected != (size_t)info.st_size
+			|| (textInfo != NULL && (size_t)textInfo->st_size != header->sourceSize)) {
+		munmap(base, info.st_size);				// not a file made by this build of isacompiler, or made from another text
+		return 1;
+	}
+
+	set->numInstructions = header->numInstructions;
+	set->instr = (struct instruction *)(base + sizeof(struct isaFileHeader));	// tables are used where they are in the file
+	set->opTable.size = header->tableSize;
+	set->opTable.slot = (int *)(set->instr + header->numInstructions);
+	set->opTable.slotHash = (unsigned int *)(set->opTable.slot + header->tableSize);
+	set->decodeTable = (struct decodeEntry *)(set->opTable.slotHash + header->tableSize);
+	set->mapping = base;
+	set->mappingSize = info.st_size;
+	if (checkMappedSet(set) != 0) {				// damaged file: an index out of its table would be followed blindly
+		munmap(base, info.st_size);
+		memset(set, 0, sizeof(struct instructionSet));
+		return 1;
+	}
+	return 0;
+}
+
+
+int checkInstructions(const struct instruction *instr, int numInstructions) {
+	// returns 0 if every instruction is in range: name ends in the array, opcode, operands and shifts fit a word
+	int i, j;
+
+	for (i=0; i<numInstructions; i++, instr++) {
+		if (memchr(instr->name, '\0', sizeof(instr->name)) == NULL || instr->numOperands < 0 || instr->numOperands > 2
+				|| instr->shiftOpCode < 0 || instr->shiftOpCode >= WORDBITS
+				|| instr->opCode < 0 || instr->opCode >= 1 << (WORDBITS - instr->shiftOpCode))
+			return 1;
+		for (j=0; j<instr->numOperands; j++) {
+			if (instr->maskOperand[j] < 0 || instr->maskOperand[j] > WORDBITS
+					|| instr->shiftOperand[j] < 0 || instr->shiftOperand[j] >= WORDBITS)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+
+int checkMappedSet(const struct instructionSet *set) {
+	// returns 0 if every index and size in the tables of a mapped file is in range, so using them can't go out of
+	// them: instructions pass checkInstructions, slots and decode entries point to instructions
+	int i, numEmpty = 0;
+
+	if (checkInstructions(set->instr, set->numInstructions) != 0)
+		return 1;
+	for (i=0; i<set->opTable.size; i++) {		// an empty slot is needed too, or a lookup of a missing name never ends
+		if (set->opTable.slot[i] == EMPTYSLOT)
+			numEmpty++;
+		else if (set->opTable.slot[i] < 0 || set->opTable.slot[i] >= set->numInstructions)
+			return 1;
+	}
+	if (numEmpty == 0)
+		return 1;
+	for (i=0; i<NUMWORDS; i++) {
+		if (set->decodeTable[i].opIndex == INVALIDOP)
+			continue;
+		if (set->decodeTable[i].opIndex >= set->numInstructions || set->decodeTable[i].numOperands > 2)
+			return 1;
+	}
+	return 0;
+}
+
+
+void freeInstructionSet(struct instructionSet *set) {
+	if (set->mapping != NULL) {
+		munmap(set->mapping, set->mappingSize);
+		set->mapping = NULL;
+		return;
+	}
+	free(set->opTable.slot);
+	free(set->opTable.slotHash);
+	free(set->decodeTable);
+	free(set->instr);
+	set->opTable.slot = NULL;
+	set->opTable.slotHash = NULL;
+	set->decodeTable = NULL;
+	set->instr = NULL;
+}
+
+
+int compileInstructionSet(const char *textName, const char *binaryName) {
+	// writes the binary file of textName; returns 1 if textName can't be read, 17 if there is no memory, 18 if binaryName can't be written
+	struct instructionSet set;
+	struct isaFileHeader header;
+	FILE *filePtr;
+	long textSize;
+	unsigned int hash;
+	int status, error;
+
+	if ((status = hashTextFile(textName, &hash, &textSize)) != 0)	// whole text is hashed, so a compiled file can be traced to its source
+		return status;
+	if ((status = parseInstructionSet(textName, &set, 1)) != 0)
+		return status;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ISAMAGIC, 8);
+	header.version = ISAVERSION;
+	header.instructionSize = sizeof(struct instruction);
+	header.decodeEntrySize = sizeof(struct decodeEntry);
+	header.numInstructions = set.numInstructions;
+	header.tableSize = set.opTable.size;
+	header.numWords = NUMWORDS;
+	header.sourceSize = textSize;
+	header.sourceHash = hash;
+	hash = hashBytes(set.instr, set.numInstructions*sizeof(struct instruction), 2166136261u);
+	hash = hashBytes(set.opTable.slot, set.opTable.size*sizeof(int), hash);
+	hash = hashBytes(set.opTable.slotHash, set.opTable.size*sizeof(unsigned int), hash);
+	header.payloadHash = hashBytes(set.decodeTable, NUMWORDS*sizeof(struct decodeEntry), hash);
+
+	if ((filePtr=fopen(binaryName, "wb"))==NULL) {
+		freeInstructionSet(&set);
+		return 18;
+	}
+	error = fwrite(&header, sizeof(header), 1, filePtr) != 1
+			|| fwrite(set.instr, sizeof(struct instruction), set.numInstructions, filePtr) != (size_t)set.numInstructions
+			|| fwrite(set.opTable.slot, sizeof(int), set.opTable.size, filePtr) != (size_t)set.opTable.size
+			|| fwrite(set.opTable.slotHash, sizeof(unsigned int), set.opTable.size, filePtr) != (size_t)set.opTable.size
+			|| fwrite(set.decodeTable, sizeof(struct decodeEntry), NUMWORDS, filePtr) != NUMWORDS;
+	if (fclose(filePtr) != 0)
+		error = 1;
+	freeInstructionSet(&set);
+	if (error) {
+		unlink(binaryName);
+		return 18;
+	}
+	return 0;
+}
+
+
+int hashTextFile(const char *textName, unsigned int *hash, long *textSize) {
+	// hash and size of the whole file textName; returns 0, 1 if it can't be read, 17 if there is no memory
+	FILE *filePtr;
+	char *text;
+
+	if ((filePtr=fopen(textName, "rb"))==NULL)
+		return 1;
+	fseek(filePtr, 0, SEEK_END);
+	*textSize = ftell(filePtr);
+	rewind(filePtr);
+	if (*textSize < 0 || (text = (char *)malloc(*textSize + 1)) == NULL) {
+		fclose(filePtr);
+		return 17;
+	}
+	*textSize = fread(text, 1, *textSize, filePtr);
+	fclose(filePtr);
+	*hash = hashBytes(text, *textSize, 2166136261u);
+	free(text);
+	return 0;
+}
+
+
+int checkCompiledSet(const char *binaryName) {	// returns 0 if binaryName can be loaded and its content matches its hash
+	struct instructionSet set;
+	const struct isaFileHeader *header;
+	unsigned int hash;
+	int valid;
+
+	if (mapInstructionSet(binaryName, &set, NULL) != 0)
+		return 1;
+	header = (const struct isaFileHeader *)set.mapping;
+	hash = hashBytes((const char *)set.mapping + sizeof(struct isaFileHeader), set.mappingSize - sizeof(struct isaFileHeader), 2166136261u);
+	valid = (hash == header->payloadHash);
+	freeInstructionSet(&set);
+	return valid ? 0 : 1;
+}
+
+
+char *compiledNameFor(const char *textName) {	// pic16f627a_InS.txt => pic16f627a_InS.bin, names without extension get .bin appended
+	size_t length = strlen(textName);
+	const char *dot = strrchr(textName, '.');
+	const char *slash = strrchr(textName, '/');
+	char *binaryName = (char *)malloc(length + 5);
+
+	if (binaryName == NULL)
+		return NULL;
+	if (dot != NULL && (slash == NULL || dot > slash))
+		length = dot - textName;
+	memcpy(binaryName, textName, length);
+	strcpy(binaryName + length, ".bin");
+	return binaryName;
+}
@@ -0,0 +1,95 @@
+/*
+
+Instruction set shared by assembler and disassembler.
+
+	An instruction set is loaded from its text file (format is described in assembler.c) or from the compiled
+	binary file made by isacompiler. The binary file has the same name with extension .bin (ex: pic16f627a_InS.bin)
+	and contains, after a header, the instructions, the hash index of their names used by the assembler and the
+	decode table of all 2^14 words used by the disassembler. It is memory mapped and used as it is, so nothing
+	has to be parsed or built at startup.
+
+	loadInstructionSet uses the binary file when it exists, is not older than the text file and was compiled from
+	a text file of the same size and hash (the text is small: hashing it costs much less than building the tables);
+	otherwise it parses the text file, exactly as before. A parsed set goes through the same range checks as a
+	mapped one, so isacompiler never writes a file that would be rejected. Before a mapped file is used,
+	every index in its tables is checked (O(NUMWORDS), much cheaper than hashing it all); a damaged file is ignored
+	and the text file is parsed. isacompiler --check verifies the hash of the whole file.
+
+*/
+
+#ifndef ISA_H
+#define ISA_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define WORDBITS   14				// each instruction is made of 14 bits
+#define NUMWORDS   (1<<WORDBITS)	// number of different words, so number of entries of decodeTable
+#define INVALIDOP  0xff				// opIndex of decodeTable entries that don't correspond to any instruction
+#define EMPTYSLOT  -1				// value of a free slot in opcodeTable
+#define ISAMAGIC   "PICISA\r\n"		// first 8 bytes of a binary instruction set file
+#define ISAVERSION 1				// must change every time the binary layout (or one of the structs below) changes
+
+struct instruction {
+	char name[10];				// name of instruction, ex: movf
+	int numOperands;			// how many operands the instruction needs. Ex: movf f,d => 2 operands
+	int maskOperand[2];			// each element is a mask of a number of '1' corresponding to operand size -- ex: 1010010 => mask is: 111 1111 => number of ones is: 7
+	int shiftOperand[2];		// each element is how many right shifts are required to use the corresponding mask
+	int opCode;					// it represents opcode
+	int shiftOpCode;			// how many right shifts are required to extract only opcode from instruction
+};
+
+struct opcodeTable {			// open addressing hash index over instructions, built once
+	int size;					// number of slots, always a power of 2 so (hash & (size-1)) picks the first slot
+	int *slot;					// each slot holds an index of instructions or EMPTYSLOT
+	unsigned int *slotHash;		// full hash of the name in each slot, compared before the name itself
+};
+
+struct lookupStats {			// counters printed with --stats
+	unsigned long lookups;		// how many tokens were searched in opcodeTable
+	unsigned long misses;		// how many tokens were not instructions (directives, operands of unknown tokens...)
+	unsigned long probes;		// how many slots were examined in total
+};
+
+struct decodeEntry {				// one entry of decodeTable, corresponding to one 14-bit word
+	unsigned char opIndex;			// index of instruction in instructions, INVALIDOP if no instruction matches
+	unsigned char numOperands;		// copied from instructions so printing doesn't need to look at it
+	unsigned short operand[2];		// operands already extracted from the word
+};
+
+struct instructionSet {			// instructions and their tables: never modified after loading, so threads can share it
+	int numInstructions;
+	struct instruction *instr;
+	struct opcodeTable opTable;
+	struct decodeEntry *decodeTable;	// NULL if it was not requested and the set was parsed from text
+	void *mapping;				// binary file mapped in memory, NULL if the set was parsed from text
+	size_t mappingSize;
+};
+
+struct isaFileHeader {			// header of a binary instruction set file
+	char magic[8];				// ISAMAGIC
+	unsigned int version;		// ISAVERSION
+	unsigned int instructionSize;	// sizeof(struct instruction) and sizeof(struct decodeEntry) of the compiler
+	unsigned int decodeEntrySize;	// that made the file: a different build can't use it
+	unsigned int numInstructions;
+	unsigned int tableSize;		// slots of opcodeTable
+	unsigned int numWords;		// entries of decodeTable, NUMWORDS
+	unsigned int sourceSize;	// size of the text file it was compiled from
+	unsigned int sourceHash;	// hash of the text file it was compiled from
+	unsigned int payloadHash;	// hash of everything after the header, checked by isacompiler --check
+	unsigned int reserved;
+};
+
+int acquireInstruction(FILE*, struct instruction *);
+unsigned int hashName(const char*, int);
+int buildOpcodeTable(struct opcodeTable*, const struct instruction*, int);
+int findInstruction(const struct opcodeTable*, const struct instruction*, const char*, int, struct lookupStats*);
+int buildDecodeTable(struct decodeEntry*, const struct instruction*, int);
+int loadInstructionSet(const char*, struct instructionSet*, int);
+int setupInstructionSet(struct instructionSet*, const struct instruction*, int, int);
+void freeInstructionSet(struct instructionSet*);
+int compileInstructionSet(const char*, const char*);
+int checkCompiledSet(const char*);
+char *compiledNameFor(const char*);
+
+#endif
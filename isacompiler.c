@@ -0,0 +1,56 @@
+/*
+
+This program compiles an instruction set file (same format used by the assembler, ex: pic16f627a_InS.txt)
+in a binary file that assembler and disassembler map in memory at startup instead of parsing the text.
+
+	/// USAGE ///
+	isacompiler instructionSet.txt [output.bin]
+		output name is the same of the instruction set with extension .bin if it is omitted.
+	isacompiler --check compiled.bin
+		verifies that compiled.bin can be used by this build and that its content matches its hash.
+
+	The compiled file is used only while it is not older than the text file, so after editing the
+	instruction set the tools go back to parsing the text until isacompiler is run again.
+
+	Build with: gcc -O2 isacompiler.c isa.c -o isacompiler
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "isa.h"
+
+#define HELP "Usage:\n isacompiler instructionSet.txt [output.bin]\n isacompiler --check compiled.bin\n"
+
+
+int main (int argc, char* argv[]) {
+	char *binaryName;
+	int status;
+
+	if (argc == 3 && strcmp(argv[1], "--check") == 0) {
+		if (checkCompiledSet(argv[2]) != 0) {
+			printf("%s is not a valid compiled instruction set for this build.\n", argv[2]);
+			return 1;
+		}
+		printf("%s is valid.\n", argv[2]);
+		return 0;
+	}
+	if (argc < 2 || argc > 3 || argv[1][0] == '-') {
+		printf(HELP);
+		return 0;
+	}
+
+	binaryName = (argc == 3) ? strdup(argv[2]) : compiledNameFor(argv[1]);
+	status = compileInstructionSet(argv[1], binaryName);
+	if (status == 1)
+		printf("Invalid instruction set file %s.\n", argv[1]);
+	else if (status == 17)
+		printf("Not enough memory.\n");
+	else if (status == 18)
+		printf("Can't write %s.\n", binaryName);
+	else
+		printf("File %s created.\n", binaryName);
+	free(binaryName);
+	return status;
+}
@@ -0,0 +1,125 @@
+/*
+
+Client side of the protocol of asmserver, see protocol.h.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "protocol.h"
+
+
+int connectServer(const char *socketName) {	// returns the socket connected to the server, -1 if it can't be reached
+	struct sockaddr_un address;
+	int fd;
+
+	if (strlen(socketName) >= sizeof(address.sun_path))
+		return -1;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketName);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+int sendRequest(int fd, int command, int recordSize, const char *name, const char *data, size_t size) {
+	// returns 0 if the whole request was sent
+	unsigned char header[REQUESTHEADER];
+	size_t nameLength = strlen(name);
+
+	if (nameLength > MAXNAME || size > MAXREQUEST)
+		return 1;
+	header[0] = command;
+	header[1] = recordSize;
+	header[2] = nameLength & 0xff;
+	header[3] = nameLength >> 8;
+	putLittle32(header + 4, size);
+	if (writeFull(fd, header, REQUESTHEADER) != 0 || writeFull(fd, name, nameLength) != 0 || writeFull(fd, data, size) != 0)
+		return 1;
+	return 0;
+}
+
+
+int readResponse(int fd, struct response *response) {	// returns 0 if a whole response was read
+	unsigned char header[RESPONSEHEADER];
+
+	memset(response, 0, sizeof(struct response));
+	if (readFull(fd, header, RESPONSEHEADER) != 0)
+		return 1;
+	response->status = header[0];
+	response->outputLength = getLittle32(header + 4);
+	response->messagesLength = getLittle32(header + 8);
+	response->output = (char *)malloc(response->outputLength + 1);	// +1: never malloc(0), and room for a '\0'
+	response->messages = (char *)malloc(response->messagesLength + 1);
+	if (response->output == NULL || response->messages == NULL
+			|| readFull(fd, response->output, response->outputLength) != 0
+			|| readFull(fd, response->messages, response->messagesLength) != 0) {
+		freeResponse(response);
+		return 1;
+	}
+	response->output[response->outputLength] = '\0';
+	response->messages[response->messagesLength] = '\0';
+	return 0;
+}
+
+
+void freeResponse(struct response *response) {
+	free(response->output);
+	free(response->messages);
+	response->output = response->messages = NULL;
+}
+
+
+int readFull(int fd, void *buffer, size_t size) {	// reads exactly size bytes, returns 1 on error or end of file
+	ssize_t numRead;
+	size_t done = 0;
+
+	while (done < size) {
+		numRead = read(fd, (char *)buffer + done, size - done);
+		if (numRead < 0 && errno == EINTR)
+			continue;
+		if (numRead <= 0)
+			return 1;
+		done += numRead;
+	}
+	return 0;
+}
+
+
+int writeFull(int fd, const void *buffer, size_t size) {	// writes exactly size bytes, returns 1 on error
+	ssize_t written;
+	size_t done = 0;
+
+	while (done < size) {
+		written = send(fd, (const char *)buffer + done, size - done, MSG_NOSIGNAL);	// no SIGPIPE if the peer is gone
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return 1;
+		done += written;
+	}
+	return 0;
+}
+
+
+void putLittle32(unsigned char *bytes, unsigned long value) {
+	bytes[0] = value & 0xff;
+	bytes[1] = (value>>8) & 0xff;
+	bytes[2] = (value>>16) & 0xff;
+	bytes[3] = (value>>24) & 0xff;
+}
+
+
+unsigned long getLittle32(const unsigned char *bytes) {
+	return bytes[0] | ((unsigned long)bytes[1]<<8) | ((unsigned long)bytes[2]<<16) | ((unsigned long)bytes[3]<<24);
+}
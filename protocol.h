@@ -0,0 +1,59 @@
+/*
+
+Protocol spoken on the Unix socket of asmserver.
+
+	A client sends requests and reads one response per request, in order, on the same connection.
+	All numbers are little endian.
+
+	/// REQUEST ///
+	 byte 0			command: REQASSEMBLE (source => Intel hex) or REQDISASSEMBLE (Intel hex => source)
+	 byte 1			data bytes per hex record for REQASSEMBLE, 0 for the default (16);
+						style of operands for REQDISASSEMBLE: 1 hex (0x..), anything else decimal (.12)
+	 bytes 2-3		length of name (used in messages as file name), at most MAXNAME
+	 bytes 4-7		length of data, at most MAXREQUEST
+	 name, data
+
+	/// RESPONSE ///
+	 byte 0			status, same values returned by assembler and disassembler (0 ok, 17 no memory, 19 errors in source,
+					20 corrupted records, 21 invalid request)
+	 bytes 1-3		0
+	 bytes 4-7		length of output (hex text or assembly text)
+	 bytes 8-11		length of messages (warnings and errors, as printed by assembler and disassembler)
+	 output, messages
+
+	A request longer than MAXREQUEST or with an unknown command gets status 21 and the connection is closed.
+
+*/
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+
+#define DEFAULTSOCKET "/tmp/asmserver.sock"
+#define REQASSEMBLE 'a'
+#define REQDISASSEMBLE 'd'
+#define REQUESTHEADER 8			// bytes of the header of a request
+#define RESPONSEHEADER 12		// bytes of the header of a response
+#define MAXNAME 4096
+#define MAXREQUEST (256<<20)	// longest data accepted, 256 MB
+#define BADREQUEST 21			// status of a request that can't be served
+
+struct response {				// a response read by a client; output and messages are malloc'ed (never NULL if status is read)
+	int status;
+	char *output;
+	size_t outputLength;
+	char *messages;
+	size_t messagesLength;
+};
+
+int connectServer(const char*);
+int sendRequest(int, int, int, const char*, const char*, size_t);
+int readResponse(int, struct response*);
+void freeResponse(struct response*);
+int readFull(int, void*, size_t);
+int writeFull(int, const void*, size_t);
+void putLittle32(unsigned char*, unsigned long);
+unsigned long getLittle32(const unsigned char*);
+
+#endif
@@ -0,0 +1,448 @@
+/*
+
+Simulator library, see simlib.h.
+
+*/
+
+#include <string.h>
+#include "simlib.h"
+#include "dislib.h"
+
+#define PCMASK (PROGRAMWORDS-1)		// program memory wraps around
+#define PCL 0x02					// registers used by the core
+#define STATUS 0x03
+#define FSR 0x04
+#define PCLATH 0x0a
+#define INTCON 0x0b
+#define FLAGC  0x01					// bits of STATUS
+#define FLAGDC 0x02
+#define FLAGZ  0x04
+#define FLAGPD 0x08
+#define FLAGTO 0x10
+#define STATUSBANK 0x60				// RP1:RP0
+#define STATUSIRP 0x80
+#define INTCONGIE 0x80
+
+// handlers of simOp.code: 0 for words that are not instructions, then one per instruction, in the order of opName
+#define OPINVALID 0
+#define OPADDWF 1
+#define OPANDWF 2
+#define OPCLRF 3
+#define OPCLRW 4
+#define OPCOMF 5
+#define OPDECF 6
+#define OPDECFSZ 7
+#define OPINCF 8
+#define OPINCFSZ 9
+#define OPIORWF 10
+#define OPMOVF 11
+#define OPMOVWF 12
+#define OPNOP 13
+#define OPRLF 14
+#define OPRRF 15
+#define OPSUBWF 16
+#define OPSWAPF 17
+#define OPXORWF 18
+#define OPBCF 19
+#define OPBSF 20
+#define OPBTFSC 21
+#define OPBTFSS 22
+#define OPADDLW 23
+#define OPANDLW 24
+#define OPCALL 25
+#define OPCLRWDT 26
+#define OPGOTO 27
+#define OPIORLW 28
+#define OPMOVLW 29
+#define OPRETFIE 30
+#define OPRETLW 31
+#define OPRETURN 32
+#define OPSLEEP 33
+#define OPSUBLW 34
+#define OPXORLW 35
+#define NUMOPS 36
+
+static const char *const opName[NUMOPS] = {"", "addwf", "andwf", "clrf", "clrw", "comf", "decf", "decfsz", "incf", "incfsz",
+	"iorwf", "movf", "movwf", "nop", "rlf", "rrf", "subwf", "swapf", "xorwf", "bcf", "bsf", "btfsc", "btfss", "addlw",
+	"andlw", "call", "clrwdt", "goto", "iorlw", "movlw", "retfie", "retlw", "return", "sleep", "sublw", "xorlw"};
+
+static const char *const haltName[] = {"running", "sleep", "loop", "invalid instruction", "cycle limit"};
+
+
+int loadImage(const char *hex, size_t size, unsigned short *words, int *numWords, int *numErrors) {
+	struct hexRecord record;
+	const char *line = hex, *end = hex + size, *lineEnd;
+	unsigned long baseAddress = 0, address;
+	int i, length;
+
+	*numWords = 0;
+	*numErrors = 0;
+	for (i=0; i<PROGRAMWORDS; i++)
+		words[i] = ERASEDWORD;
+	for (; line < end; line = lineEnd + 1) {
+		if ((lineEnd = memchr(line, '\n', end - line)) == NULL)
+			lineEnd = end;
+		length = lineEnd - line;
+		while (length > 0 && (line[length-1] == '\r' || line[length-1] == ' ' || line[length-1] == '\t'))
+			length--;
+		while (length > 0 && (*line == ' ' || *line == '\t')) {
+			line++;
+			length--;
+		}
+		if (length == 0)
+			continue;
+		if (parseRecord(line, length, &record) != 0) {
+			(*numErrors)++;
+			continue;
+		}
+		if (record.type == 1)						// end of file
+			break;
+		else if (record.type == 4)
+			baseAddress = ((unsigned long)record.byte[4]<<24) | ((unsigned long)record.byte[5]<<16);
+		else if (record.type == 2)
+			baseAddress = (((unsigned long)record.byte[4]<<8) | record.byte[5]) << 4;
+		else if (record.type == 0) {
+			address = baseAddress + record.address;
+			for (i=0; i<record.dataLength; i++, address++) {	// low byte first; outside program memory: ignored
+				if (address/2 >= PROGRAMWORDS)
+					continue;
+				if (address & 1)
+					words[address/2] = (words[address/2] & 0x00ff) | ((record.byte[4+i] & 0x3f) << 8);
+				else
+					words[address/2] = (words[address/2] & 0xff00) | record.byte[4+i];
+				if ((int)(address/2) >= *numWords)
+					*numWords = address/2 + 1;
+			}
+		}
+	}
+	return (*numErrors > 0) ? 20 : 0;
+}
+
+
+int predecodeProgram(const struct instructionSet *set, const unsigned short *words, struct simProgram *program) {
+	unsigned char code[INVALIDOP+1];		// handler of each instruction of set
+	const struct decodeEntry *entry;
+	int i, j, found, bank, f;
+
+	memset(code, OPINVALID, sizeof(code));
+	for (j=1; j<NUMOPS; j++) {
+		for (i=0, found=0; i<set->numInstructions && i<INVALIDOP; i++) {
+			if (strcmp(set->instr[i].name, opName[j]) == 0) {
+				code[i] = j;
+				found = 1;
+			}
+		}
+		if (!found)
+			return 1;
+	}
+
+	for (i=0; i<PROGRAMWORDS; i++) {		// operands are extracted once, not at every execution
+		entry = &set->decodeTable[words[i] & (NUMWORDS-1)];
+		program->op[i].code = code[entry->opIndex];
+		program->op[i].bit = 0;
+		program->op[i].arg = entry->operand[0];	// f or k
+		if (code[entry->opIndex] >= OPBCF && code[entry->opIndex] <= OPBTFSS)
+			program->op[i].bit = 1 << entry->operand[1];	// bit operations: f, b
+		else if (entry->numOperands == 2)
+			program->op[i].bit = entry->operand[1];	// byte operations: f, d
+	}
+
+	for (i=0; i<DATABYTES; i++) {			// where each banked address is in picState.file
+		bank = i >> 7;
+		f = i & 0x7f;
+		if (f == 0)
+			program->map[i] = NOWHERE;		// INDF through INDF
+		else if (f == PCL || f == STATUS || f == FSR || f == PCLATH || f == INTCON || f >= 0x70)
+			program->map[i] = f;			// same register in all banks
+		else if (bank >= 2 && (f == 0x01 || f == 0x06))
+			program->map[i] = ((bank & 1) << 7) | f;	// TMR0, PORTB in bank 2, OPTION, TRISB in bank 3
+		else if ((bank == 2 && f >= 0x50) || (bank == 3 && f >= 0x20))
+			program->map[i] = NOWHERE;		// no general purpose registers there
+		else
+			program->map[i] = i;
+	}
+	return 0;
+}
+
+
+void resetState(struct picState *state) {	// power-on reset
+	memset(state, 0, sizeof(struct picState));
+	state->file[STATUS] = FLAGTO | FLAGPD;
+	state->file[0x81] = 0xff;				// OPTION, TRISA, TRISB
+	state->file[0x85] = 0xff;
+	state->file[0x86] = 0xff;
+}
+
+
+unsigned long long runProgram(const struct simProgram *program, struct picState *state, unsigned long long maxCycles) {
+	// runs from state until it halts; returns the number of instructions executed
+	const struct simOp *op;
+	const unsigned short *map = program->map;
+	unsigned char *file = state->file;
+	unsigned int pc = state->pc, target, address, value, result;
+	unsigned int w = state->w;
+	int sp = state->stackPointer;
+	unsigned long long cycles = state->cycles, instructions = 0;
+
+	// address of the file register of op: banked with RP1:RP0, or through FSR and IRP for INDF
+	#define FILEADDRESS()	(op->arg ? map[((file[STATUS] & STATUSBANK) << 2) | op->arg] \
+								: map[((file[STATUS] & STATUSIRP) << 1) | file[FSR]])
+	#define READ(a)			((a) == PCL ? (pc & 0xff) : file[a])
+	#define WRITE(a, v)		do {											\
+								if ((a) == STATUS)							\
+									file[STATUS] = ((v) & ~(FLAGTO | FLAGPD)) | (file[STATUS] & (FLAGTO | FLAGPD)); \
+								else if ((a) == PCL) {						\
+									pc = ((file[PCLATH] << 8) | (v)) & PCMASK;	\
+									file[PCL] = (v);						\
+									cycles++;								\
+								}											\
+								else										\
+									file[a] = (v);							\
+								file[NOWHERE] = 0;							\
+							} while (0)
+	#define STORE(v)		do { if (op->bit) WRITE(address, v); else w = (v); } while (0)	// destination d
+	#define SETFLAGS(mask, v)	(file[STATUS] = (file[STATUS] & ~(mask)) | (v))
+	#define ZERO(v)			(((v) & 0xff) == 0 ? FLAGZ : 0)
+	#define SKIP()			do { pc = (pc + 1) & PCMASK; cycles++; } while (0)
+	#define JUMP(k)			do { pc = ((k) | ((file[PCLATH] & 0x18) << 8)) & PCMASK; cycles++; } while (0)
+	#define POP()			do { sp = (sp - 1) & (STACKSIZE-1); pc = state->stack[sp]; cycles++; } while (0)
+	#define FETCH()			do {											\
+								if (cycles >= maxCycles) {					\
+									state->halt = SIMLIMIT;					\
+									goto stop;								\
+								}											\
+								op = &program->op[pc];						\
+								pc = (pc + 1) & PCMASK;						\
+								cycles++;									\
+								instructions++;								\
+							} while (0)
+
+#if defined(__GNUC__)
+	#define L(code)			&&label##code
+	static const void *const handler[NUMOPS] = {L(OPINVALID), L(OPADDWF), L(OPANDWF), L(OPCLRF), L(OPCLRW), L(OPCOMF),
+		L(OPDECF), L(OPDECFSZ), L(OPINCF), L(OPINCFSZ), L(OPIORWF), L(OPMOVF), L(OPMOVWF), L(OPNOP), L(OPRLF), L(OPRRF),
+		L(OPSUBWF), L(OPSWAPF), L(OPXORWF), L(OPBCF), L(OPBSF), L(OPBTFSC), L(OPBTFSS), L(OPADDLW), L(OPANDLW), L(OPCALL),
+		L(OPCLRWDT), L(OPGOTO), L(OPIORLW), L(OPMOVLW), L(OPRETFIE), L(OPRETLW), L(OPRETURN), L(OPSLEEP), L(OPSUBLW),
+		L(OPXORLW)};
+	#define OP(code)		label##code:
+	#define NEXT()			do { FETCH(); goto *handler[op->code]; } while (0)	// each handler dispatches the next one
+
+	state->halt = SIMRUNNING;
+	NEXT();
+#else
+	#define OP(code)		case code:
+	#define NEXT()			continue
+
+	state->halt = SIMRUNNING;
+	for (;;) {
+		FETCH();
+		switch (op->code) {
+#endif
+
+	OP(OPADDWF)
+		address = FILEADDRESS();
+		value = READ(address);
+		result = value + w;
+		STORE(result & 0xff);
+		SETFLAGS(FLAGC | FLAGDC | FLAGZ, (result >> 8) | ((((value & 0xf) + (w & 0xf)) >> 3) & FLAGDC) | ZERO(result));
+		NEXT();
+	OP(OPANDWF)
+		address = FILEADDRESS();
+		result = READ(address) & w;
+		STORE(result);
+		SETFLAGS(FLAGZ, ZERO(result));
+		NEXT();
+	OP(OPCLRF)
+		address = FILEADDRESS();
+		WRITE(address, 0);
+		SETFLAGS(FLAGZ, FLAGZ);
+		NEXT();
+	OP(OPCLRW)
+		w = 0;
+		SETFLAGS(FLAGZ, FLAGZ);
+		NEXT();
+	OP(OPCOMF)
+		address = FILEADDRESS();
+		result = ~READ(address) & 0xff;
+		STORE(result);
+		SETFLAGS(FLAGZ, ZERO(result));
+		NEXT();
+	OP(OPDECF)
+		address = FILEADDRESS();
+		result = (READ(address) - 1) & 0xff;
+		STORE(result);
+		SETFLAGS(FLAGZ, ZERO(result));
+		NEXT();
+	OP(OPDECFSZ)
+		address = FILEADDRESS();
+		result = (READ(address) - 1) & 0xff;
+		STORE(result);
+		if (result == 0)
+			SKIP();
+		NEXT();
+	OP(OPINCF)
+		address = FILEADDRESS();
+		result = (READ(address) + 1) & 0xff;
+		STORE(result);
+		SETFLAGS(FLAGZ, ZERO(result));
+		NEXT();
+	OP(OPINCFSZ)
+		address = FILEADDRESS();
+		result = (READ(address) + 1) & 0xff;
+		STORE(result);
+		if (result == 0)
+			SKIP();
+		NEXT();
+	OP(OPIORWF)
+		address = FILEADDRESS();
+		result = READ(address) | w;
+		STORE(result);
+		SETFLAGS(FLAGZ, ZERO(result));
+		NEXT();
+	OP(OPMOVF)
+		address = FILEADDRESS();
+		result = READ(address);
+		STORE(result);
+		SETFLAGS(FLAGZ, ZERO(result));
+		NEXT();
+	OP(OPMOVWF)
+		address = FILEADDRESS();
+		WRITE(address, w);
+		NEXT();
+	OP(OPNOP)
+		NEXT();
+	OP(OPRLF)
+		address = FILEADDRESS();
+		value = READ(address);
+		result = ((value << 1) | (file[STATUS] & FLAGC)) & 0xff;
+		STORE(result);
+		SETFLAGS(FLAGC, value >> 7);
+		NEXT();
+	OP(OPRRF)
+		address = FILEADDRESS();
+		value = READ(address);
+		result = (value >> 1) | ((file[STATUS] & FLAGC) << 7);
+		STORE(result);
+		SETFLAGS(FLAGC, value & 1);
+		NEXT();
+	OP(OPSUBWF)								// f - W: C and DC are set when there is no borrow
+		address = FILEADDRESS();
+		value = READ(address);
+		result = (value - w) & 0xff;
+		STORE(result);
+		SETFLAGS(FLAGC | FLAGDC | FLAGZ, (value >= w ? FLAGC : 0) | ((value & 0xf) >= (w & 0xf) ? FLAGDC : 0) | ZERO(result));
+		NEXT();
+	OP(OPSWAPF)
+		address = FILEADDRESS();
+		value = READ(address);
+		STORE(((value << 4) | (value >> 4)) & 0xff);
+		NEXT();
+	OP(OPXORWF)
+		address = FILEADDRESS();
+		result = READ(address) ^ w;
+		STORE(result);
+		SETFLAGS(FLAGZ, ZERO(result));
+		NEXT();
+	OP(OPBCF)
+		address = FILEADDRESS();
+		value = READ(address) & ~op->bit;
+		WRITE(address, value);
+		NEXT();
+	OP(OPBSF)
+		address = FILEADDRESS();
+		value = READ(address) | op->bit;
+		WRITE(address, value);
+		NEXT();
+	OP(OPBTFSC)
+		address = FILEADDRESS();
+		if ((READ(address) & op->bit) == 0)
+			SKIP();
+		NEXT();
+	OP(OPBTFSS)
+		address = FILEADDRESS();
+		if (READ(address) & op->bit)
+			SKIP();
+		NEXT();
+	OP(OPADDLW)
+		result = op->arg + w;
+		SETFLAGS(FLAGC | FLAGDC | FLAGZ, (result >> 8) | ((((op->arg & 0xf) + (w & 0xf)) >> 3) & FLAGDC) | ZERO(result));
+		w = result & 0xff;
+		NEXT();
+	OP(OPANDLW)
+		w &= op->arg;
+		SETFLAGS(FLAGZ, ZERO(w));
+		NEXT();
+	OP(OPCALL)
+		state->stack[sp] = pc;
+		sp = (sp + 1) & (STACKSIZE-1);		// a ninth call overwrites the first return address, as the hardware does
+		JUMP(op->arg);
+		NEXT();
+	OP(OPCLRWDT)
+		SETFLAGS(FLAGTO | FLAGPD, FLAGTO | FLAGPD);
+		NEXT();
+	OP(OPGOTO)
+		target = ((op->arg | ((file[PCLATH] & 0x18) << 8)) & PCMASK);
+		if (target == ((pc - 1) & PCMASK)) {	// goto $: the program is over
+			cycles++;
+			pc = target;
+			state->halt = SIMLOOP;
+			goto stop;
+		}
+		JUMP(op->arg);
+		NEXT();
+	OP(OPIORLW)
+		w |= op->arg;
+		SETFLAGS(FLAGZ, ZERO(w));
+		NEXT();
+	OP(OPMOVLW)
+		w = op->arg;
+		NEXT();
+	OP(OPRETFIE)
+		POP();
+		file[INTCON] |= INTCONGIE;
+		NEXT();
+	OP(OPRETLW)
+		w = op->arg;
+		POP();
+		NEXT();
+	OP(OPRETURN)
+		POP();
+		NEXT();
+	OP(OPSLEEP)
+		SETFLAGS(FLAGTO | FLAGPD, FLAGTO);
+		state->halt = SIMSLEEP;
+		goto stop;
+	OP(OPSUBLW)								// k - W
+		result = (op->arg - w) & 0xff;
+		SETFLAGS(FLAGC | FLAGDC | FLAGZ, (op->arg >= w ? FLAGC : 0) | ((op->arg & 0xf) >= (w & 0xf) ? FLAGDC : 0) | ZERO(result));
+		w = result;
+		NEXT();
+	OP(OPXORLW)
+		w ^= op->arg;
+		SETFLAGS(FLAGZ, ZERO(w));
+		NEXT();
+	OP(OPINVALID)
+		pc = (pc - 1) & PCMASK;				// stop on the invalid word, not executed
+		cycles--;
+		instructions--;
+		state->halt = SIMINVALID;
+		goto stop;
+
+#if !defined(__GNUC__)
+		}
+	}
+#endif
+
+stop:
+	state->pc = pc;
+	state->w = w;
+	state->stackPointer = sp;
+	state->cycles = cycles;
+	state->instructions += instructions;
+	return instructions;
+}
+
+
+const char *haltText(int halt) {			// why a program stopped
+	return (halt >= 0 && halt < (int)(sizeof(haltName)/sizeof(haltName[0]))) ? haltName[halt] : "unknown";
+}
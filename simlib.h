@@ -0,0 +1,82 @@
+/*
+
+Simulator library: runs PIC16F627A programs (as words in memory) without hardware.
+
+	Nothing here opens files or uses global data: a simProgram is made once from the words of a program and only read
+	while it runs, so any number of threads can run it at the same time, each with its own picState.
+
+	/// API ///
+	loadImage(hex, size, words, &numWords, &numErrors)
+		reads the program words of an Intel hex file in memory into words (PROGRAMWORDS of them, unprogrammed words
+		are 0x3fff as in an erased device); numWords is one past the highest word loaded. Records outside program
+		memory (configuration word, EEPROM data) are ignored. Returns 0, or 20 if some records are corrupted.
+	predecodeProgram(set, words, &program)
+		decodes every word once (with the decode table of the instruction set, see isa.h) into a compact op: the
+		handler to run and its operands ready to use. Returns 0, or 1 if an instruction of the PIC16F627A is missing
+		from set.
+	resetState(&state) / runProgram(&program, &state, maxCycles)
+		puts the processor in its power-on state, then runs it until SLEEP, a goto to itself (how programs usually
+		end), an invalid word or maxCycles; state.halt tells which. Returns the number of instructions executed.
+
+	/// MODEL ///
+	W, the register file (4 banks of 128 bytes, with the registers shared by all banks mapped once: INDF, PCL,
+	STATUS, FSR, PCLATH, INTCON and 0x70-0x7f), indirect addressing through FSR and IRP, STATUS flags C, DC, Z and
+	TO, PD, the 8-level circular stack and the 13-bit program counter, with PCLATH used by writes to PCL, goto and
+	call. Skips, branches and writes to PCL take 2 cycles, everything else 1. Peripherals, interrupts and the
+	watchdog are not simulated: their registers are plain memory.
+
+	/// DISPATCH ///
+	Each op holds the number of its handler; with GCC (and compatible compilers) runProgram jumps from the end of
+	each handler straight to the next one through a table of label addresses (computed goto), so there is no
+	central switch and each handler has its own, better predicted, indirect jump. Other compilers use a switch.
+
+	Build: compile simlib.c, dislib.c (records are read with parseRecord) and isa.c with the program that uses them.
+
+*/
+
+#ifndef SIMLIB_H
+#define SIMLIB_H
+
+#include <stddef.h>
+#include "isa.h"
+
+#define PROGRAMWORDS 1024			// program memory of the PIC16F627A
+#define ERASEDWORD 0x3fff			// value of an unprogrammed word
+#define DATABYTES 512				// 4 banks of 128 bytes
+#define NOWHERE DATABYTES			// physical address of unimplemented registers: reads 0, writes are lost
+#define STACKSIZE 8
+#define SIMRUNNING 0				// values of picState.halt
+#define SIMSLEEP 1					// SLEEP executed
+#define SIMLOOP 2					// goto to itself
+#define SIMINVALID 3				// a word that is not an instruction
+#define SIMLIMIT 4					// maxCycles reached
+
+struct simOp {						// a predecoded program word
+	unsigned char code;				// handler, see simlib.c
+	unsigned char bit;				// mask of the bit of bcf, bsf, btfsc, btfss; 1 if the destination is f, 0 if W
+	unsigned short arg;				// file register (7 bits) or literal (8 or 11 bits)
+};
+
+struct simProgram {					// read only while programs run
+	struct simOp op[PROGRAMWORDS];
+	unsigned short map[DATABYTES];	// banked address (RP1:RP0 or IRP, and 7 bits) => physical address in picState.file
+};
+
+struct picState {
+	unsigned char file[DATABYTES+1];	// physical registers, file[NOWHERE] is always 0
+	unsigned short stack[STACKSIZE];
+	int stackPointer;				// next level to be pushed, the stack wraps around when full
+	unsigned int pc;				// address of the next instruction (or of the one that stopped the program)
+	unsigned char w;
+	unsigned long long cycles;
+	unsigned long long instructions;
+	int halt;						// SIMRUNNING, SIMSLEEP, SIMLOOP, SIMINVALID or SIMLIMIT
+};
+
+int loadImage(const char*, size_t, unsigned short*, int*, int*);
+int predecodeProgram(const struct instructionSet*, const unsigned short*, struct simProgram*);
+void resetState(struct picState*);
+unsigned long long runProgram(const struct simProgram*, struct picState*, unsigned long long);
+const char *haltText(int);
+
+#endif
@@ -0,0 +1,244 @@
+/*
+
+Simulator of the PIC16F627A: runs Intel hex images made by the assembler, for regression tests without hardware.
+
+	/// USAGE ///
+	simulator [-j threads] [-c cycles] [-n copies] [-d] instructionSet image.hex ...
+	 -j threads		threads running simulations (default: number of cores).
+	 -c cycles		a simulation stops after this many cycles (default 100000000).
+	 -n copies		each image is simulated this many times, to measure speed (default 1).
+	 -d				print the registers (physical file, 512 bytes) of each image when it stops.
+	Each image is loaded, predecoded once and run from power-on reset until SLEEP, a goto to itself, an invalid word
+	or the cycle limit (see simlib.h for what is simulated). Simulations are independent: threads take them one at a
+	time and share the predecoded programs read only. When all are done, one line per image is printed, in the order
+	they were passed, with why it stopped, where, cycles, instructions, W and STATUS; then the total of instructions and
+	the speed of the simulator in millions of simulated instructions per second (MIPS).
+	The program returns 16 if an image can't be read, 20 if it has corrupted records (it is not run).
+	Build with: gcc -O2 -pthread simulator.c simlib.c dislib.c isa.c stats.c -o simulator (or make)
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "isa.h"
+#include "simlib.h"
+
+#define HELP "Usage: simulator [-j threads] [-c cycles] [-n copies] [-d] instructionSet image.hex ...\n"
+#define READCHUNK 65536				// bytes read at a time from an image
+
+struct image {
+	const char *name;
+	int status;						// 0, 16 can't be read, 20 corrupted records
+	int numWords;					// one past the highest word loaded
+	struct simProgram program;
+};
+
+struct simulation {					// shared by the threads
+	struct image *images;
+	int numImages;
+	int numCopies;
+	unsigned long long maxCycles;
+	struct picState *states;		// states[image*numCopies + copy]
+	int nextJob;					// first simulation not taken yet, protected by lock
+	pthread_mutex_t lock;
+};
+
+void *simulationWorker(void*);
+int readImage(const char*, char**, size_t*);
+void printRegisters(const struct picState*);
+double wallTime(void);
+
+
+int main (int argc, char* argv[]) {
+	struct instructionSet instructionSet;
+	struct simulation sim;
+	struct image *image;
+	struct picState *state;
+	unsigned short words[PROGRAMWORDS];
+	pthread_t *threads;
+	char *hex;
+	size_t size;
+	int i, j, numErrors, numThreads = 0, dump = 0, status = 0;
+	unsigned long long totalInstructions = 0, totalCycles = 0;
+	double start;
+
+	/***********		Read options		************/
+	memset(&sim, 0, sizeof(sim));
+	sim.numCopies = 1;
+	sim.maxCycles = 100000000;
+	while (argc > 2 && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-d") == 0) {
+			dump = 1;
+			argc--;
+			argv++;
+			continue;
+		}
+		if (strcmp(argv[1], "-j") == 0)
+			numThreads = atoi(argv[2]);
+		else if (strcmp(argv[1], "-c") == 0)
+			sim.maxCycles = strtoull(argv[2], NULL, 10);
+		else if (strcmp(argv[1], "-n") == 0)
+			sim.numCopies = atoi(argv[2]);
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 3 || sim.numCopies < 1) {
+		printf(HELP);
+		return 0;
+	}
+	if (loadInstructionSet(argv[1], &instructionSet, 1) != 0) {	// decode table is needed
+		printf("Insert a valid instruction set file as FIRST argument.\n");
+		return 14;
+	}
+
+	/***********		Load and predecode images		************/
+	sim.numImages = argc - 2;
+	sim.images = (struct image *)calloc(sim.numImages, sizeof(struct image));
+	sim.states = (struct picState *)calloc((size_t)sim.numImages*sim.numCopies, sizeof(struct picState));
+	if (sim.images == NULL || sim.states == NULL) {
+		printf("Not enough memory.\n");
+		return 17;
+	}
+	for (i=0; i<sim.numImages; i++) {
+		image = &sim.images[i];
+		image->name = argv[i+2];
+		if (readImage(image->name, &hex, &size) != 0) {
+			printf("%s: can't be read.\n", image->name);
+			image->status = status = 16;
+			continue;
+		}
+		image->status = loadImage(hex, size, words, &image->numWords, &numErrors);
+		free(hex);
+		if (image->status != 0) {
+			printf("%s: %d corrupted records, not run.\n", image->name, numErrors);
+			if (status == 0)
+				status = 20;
+			continue;
+		}
+		if (predecodeProgram(&instructionSet, words, &image->program) != 0) {
+			printf("The instruction set %s is not the one of the PIC16F627A.\n", argv[1]);
+			return 14;
+		}
+	}
+
+	/***********		Run simulations		************/
+	if (numThreads <= 0)
+		numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (numThreads > sim.numImages*sim.numCopies)
+		numThreads = sim.numImages*sim.numCopies;
+	threads = (pthread_t *)malloc(numThreads*sizeof(pthread_t));
+	pthread_mutex_init(&sim.lock, NULL);
+	start = wallTime();
+	for (i=1; i<numThreads; i++)
+		pthread_create(&threads[i], NULL, simulationWorker, &sim);
+	simulationWorker(&sim);					// calling thread works too
+	for (i=1; i<numThreads; i++)
+		pthread_join(threads[i], NULL);
+	start = wallTime() - start;
+	pthread_mutex_destroy(&sim.lock);
+	free(threads);
+
+	/***********		Report, in the order of images		************/
+	for (i=0; i<sim.numImages; i++) {
+		if (sim.images[i].status != 0)
+			continue;
+		state = &sim.states[i*sim.numCopies];
+		printf("%s: %s at 0x%03x, %llu cycles, %llu instructions, W=0x%02x STATUS=0x%02x\n", sim.images[i].name,
+				haltText(state->halt), state->pc, state->cycles, state->instructions, state->w, state->file[0x03]);
+		for (j=1; j<sim.numCopies; j++) {	// simulations are deterministic: copies must end the same way
+			if (memcmp(&state[j], state, sizeof(struct picState)) != 0) {
+				printf("%s: copy %d ended differently.\n", sim.images[i].name, j);
+				status = 1;
+			}
+		}
+		if (dump)
+			printRegisters(state);
+		for (j=0; j<sim.numCopies; j++) {
+			totalInstructions += state[j].instructions;
+			totalCycles += state[j].cycles;
+		}
+	}
+	printf("%d simulations, %llu instructions, %llu cycles, %d threads, %.3f s, %.1f MIPS\n", sim.numImages*sim.numCopies,
+			totalInstructions, totalCycles, numThreads, start, (start > 0) ? totalInstructions/start/1e6 : 0);
+
+	free(sim.images);
+	free(sim.states);
+	freeInstructionSet(&instructionSet);
+	return status;
+}
+
+
+// FUNCTIONS DEFINITION
+void *simulationWorker(void *arg) {
+	struct simulation *sim = (struct simulation *)arg;
+	struct image *image;
+	int job;
+
+	for (;;) {
+		pthread_mutex_lock(&sim->lock);
+		job = sim->nextJob++;
+		pthread_mutex_unlock(&sim->lock);
+		if (job >= sim->numImages*sim->numCopies)
+			return NULL;
+		image = &sim->images[job/sim->numCopies];
+		if (image->status != 0)
+			continue;
+		resetState(&sim->states[job]);
+		runProgram(&image->program, &sim->states[job], sim->maxCycles);
+	}
+}
+
+
+int readImage(const char *fileName, char **data, size_t *size) {	// reads the whole file, '-' is standard input
+	FILE *filePtr;
+	char *bigger;
+	size_t capacity = 0, numRead;
+
+	if ((filePtr = (strcmp(fileName, "-") == 0) ? stdin : fopen(fileName, "rb")) == NULL)
+		return 1;
+	*data = NULL;
+	*size = 0;
+	do {
+		if (*size + READCHUNK > capacity) {
+			capacity = (capacity == 0) ? 4*READCHUNK : 2*capacity;
+			if ((bigger = (char *)realloc(*data, capacity)) == NULL) {
+				free(*data);
+				if (filePtr != stdin)
+					fclose(filePtr);
+				return 1;
+			}
+			*data = bigger;
+		}
+		numRead = fread(*data + *size, 1, READCHUNK, filePtr);
+		*size += numRead;
+	} while (numRead > 0);
+	if (filePtr != stdin)
+		fclose(filePtr);
+	return 0;
+}
+
+
+void printRegisters(const struct picState *state) {	// 16 registers per line, by physical address
+	int i, j;
+
+	for (i=0; i<DATABYTES; i+=16) {
+		printf("  0x%03x:", i);
+		for (j=0; j<16; j++)
+			printf(" %02x", state->file[i+j]);
+		printf("\n");
+	}
+}
+
+
+double wallTime(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec*1e-9;
+}
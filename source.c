@@ -0,0 +1,67 @@
+/*
+
+Input files in memory, see source.h.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "source.h"
+
+
+int loadSource(const char *fileName, struct sourceText *source) {
+	struct stat info;
+	char *buffer = NULL, *bigger;
+	size_t capacity = 0;
+	ssize_t numRead;
+	int fd = 0;									// '-' stands for standard input
+
+	if (strcmp(fileName, "-") != 0 && (fd = open(fileName, O_RDONLY)) < 0)
+		return 1;
+
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {	// regular file: map it, no copy at all
+		source->data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (source->data != MAP_FAILED) {
+			madvise((void *)source->data, info.st_size, MADV_SEQUENTIAL);
+			source->size = info.st_size;
+			source->isMapped = 1;
+			if (fd != 0)
+				close(fd);
+			return 0;
+		}
+	}
+
+	source->size = 0;							// pipe, terminal or empty file: read everything in a growing buffer
+	do {
+		if (source->size + READCHUNK > capacity) {
+			capacity = (capacity == 0) ? 4*READCHUNK : 2*capacity;
+			if ((bigger = (char *)realloc(buffer, capacity)) == NULL) {
+				free(buffer);
+				if (fd != 0)
+					close(fd);
+				return 1;
+			}
+			buffer = bigger;
+		}
+		numRead = read(fd, buffer + source->size, READCHUNK);
+		if (numRead > 0)
+			source->size += numRead;
+	} while (numRead > 0);
+	if (fd != 0)
+		close(fd);
+	source->data = buffer;
+	source->isMapped = 0;
+	return (numRead < 0) ? 1 : 0;
+}
+
+
+void freeSource(struct sourceText *source) {
+	if (source->isMapped)
+		munmap((void *)source->data, source->size);
+	else
+		free((void *)source->data);
+}
@@ -0,0 +1,29 @@
+/*
+
+Whole input file in memory, shared by assembler and disassembler.
+
+	loadSource(fileName, &source) memory maps a regular file, so nothing is copied; a pipe, a terminal or an empty
+	file ('-' is standard input) is read READCHUNK bytes at a time in a buffer that doubles. It returns 0, or 1 if the
+	file can't be read. freeSource unmaps or frees the data.
+
+	Build: compile source.c with the program that uses it.
+
+*/
+
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+
+#define READCHUNK 65536				// bytes read at a time when the source can't be memory mapped
+
+struct sourceText {				// the whole file in memory
+	const char *data;
+	size_t size;
+	int isMapped;				// 1 if data is memory mapped, 0 if it is a malloc'ed copy
+};
+
+int loadSource(const char*, struct sourceText*);
+void freeSource(struct sourceText*);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+
+Phase timers of --stats, see stats.h.
+
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include "stats.h"
+
+static double clockSeconds(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec*1e-9;
+}
+
+
+void startClock(struct tickClock *clock) {
+	clock->seconds = clockSeconds();
+	clock->ticks = readTicks();
+}
+
+
+double tickRate(struct tickClock *clock) {	// ticks per second since startClock
+	double seconds;
+	unsigned long long ticks;
+
+	do {									// at least 1 ms, or the rate is not precise
+		seconds = clockSeconds() - clock->seconds;
+		ticks = readTicks() - clock->ticks;
+	} while (seconds < 0.001);
+	return ticks/seconds;
+}
+
+
+double phaseSeconds(const struct phaseTimer *timer, int phase, double rate) {
+	// time spent in phase, estimated from the samples if not all events were timed
+	if (timer->samples[phase] == 0)
+		return 0;
+	return (double)timer->ticks[phase]/timer->samples[phase]*timer->events[phase]/rate;
+}
+
+
+void addPhases(struct phaseTimer *total, const struct phaseTimer *timer) {
+	int i;
+
+	for (i=0; i<MAXPHASES; i++) {
+		total->ticks[i] += timer->ticks[i];
+		total->samples[i] += timer->samples[i];
+		total->events[i] += timer->events[i];
+	}
+}
+
+
+void printPhases(FILE *filePtr, const char* const *names, int numPhases, const struct phaseTimer *timer, double rate) {
+	// prints "phases": {...} with seconds, events and samples of each phase
+	int i;
+
+	fprintf(filePtr, "  \"phases\": {\n");
+	for (i=0; i<numPhases; i++)
+		fprintf(filePtr, "    \"%s\": {\"seconds\": %.6f, \"events\": %lu, \"samples\": %lu}%s\n", names[i],
+				phaseSeconds(timer, i, rate), timer->events[i], timer->samples[i], (i < numPhases-1) ? "," : "");
+	fprintf(filePtr, "  }");
+}
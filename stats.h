@@ -0,0 +1,62 @@
+/*
+
+Phase timers of --stats, shared by assembler and disassembler.
+
+	Time is read with the cycle counter of the processor where there is one (rdtsc on x86, a few nanoseconds),
+	otherwise with clock_gettime. Phases that run once per block (a flush of words, a write) are timed every time;
+	phases that run once per token, word or record would be slowed down by the timer itself, so only 1 item in
+	SAMPLEEVERY is timed and the time of a phase is estimated as its mean time per sample by its number of events.
+	When stats are not wanted the timer pointer is NULL and nothing is read or counted.
+
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define MAXPHASES 8
+#define SAMPLEEVERY 64		// 1 item out of SAMPLEEVERY is timed in phases done once per item, must be a power of 2
+
+struct phaseTimer {			// time spent in each phase of a tool
+	unsigned long long ticks[MAXPHASES];	// ticks measured
+	unsigned long samples[MAXPHASES];		// times the phase was measured...
+	unsigned long events[MAXPHASES];		// ...out of times it was done
+};
+
+struct tickClock {			// converts ticks to seconds, measured over the run of the program
+	unsigned long long ticks;
+	double seconds;
+};
+
+static inline unsigned long long readTicks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000000ULL + now.tv_nsec;
+#endif
+}
+
+static inline unsigned long long lapPhase(struct phaseTimer *timer, int phase, unsigned long long start) {
+	// adds the time from start to now to phase, returns now so the next phase starts from it
+	unsigned long long now = readTicks();
+
+	timer->ticks[phase] += now - start;
+	timer->samples[phase]++;
+	return now;
+}
+
+void startClock(struct tickClock*);
+double tickRate(struct tickClock*);
+double phaseSeconds(const struct phaseTimer*, int, double);
+void addPhases(struct phaseTimer*, const struct phaseTimer*);
+void printPhases(FILE*, const char* const*, int, const struct phaseTimer*, double);
+
+#endif